@@ -0,0 +1,146 @@
+/*
+  Carrito de líneas agregadas sobre una arena que se vacía al cerrar cada venta.
+*/
+
+#include "cart.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_MIN_BLOCK  (16 * 1024)
+#define ARENA_ALIGN      16
+#define CART_MIN_LINES   32
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t      size;
+    size_t      used;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+// ---------------------------------------------------------------------------
+// Arena
+// ---------------------------------------------------------------------------
+/**
+ * Reserva memoria de la arena, alineada a ARENA_ALIGN. Cuando el bloque en
+ * uso se llena se encadena otro del doble de tamaño.
+ *
+ * @return  NULL si no hay memoria
+ */
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    ArenaBlock *block = arena->head;
+    if (!block || block->size - block->used < size) {
+        size_t block_size = block ? block->size * 2 : ARENA_MIN_BLOCK;
+        while (block_size < size) block_size *= 2;
+        ArenaBlock *grown = malloc(sizeof(ArenaBlock) + block_size);
+        if (!grown)
+            return NULL;
+        grown->next = block;
+        grown->size = block_size;
+        grown->used = 0;
+        arena->head = grown;
+        block = grown;
+    }
+    void *p = block->data + block->used;
+    block->used += size;
+    return p;
+}
+
+/* Vacía la arena y se queda solo con el bloque más grande para la siguiente venta. */
+void arena_reset(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    if (!block)
+        return;
+    ArenaBlock *older = block->next;
+    while (older) {
+        ArenaBlock *next = older->next;
+        free(older);
+        older = next;
+    }
+    block->next = NULL;
+    block->used = 0;
+}
+
+void arena_free(Arena *arena) {
+    arena_reset(arena);
+    free(arena->head);
+    arena->head = NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Carrito
+// ---------------------------------------------------------------------------
+void cart_init(Cart *cart) {
+    memset(cart, 0, sizeof(*cart));
+}
+
+/* Dobla la capacidad de líneas; el arreglo viejo se queda en la arena hasta el reset. */
+static bool cart_grow(Cart *cart) {
+    size_t capacity = cart->capacity ? cart->capacity * 2 : CART_MIN_LINES;
+    CartLine *lines = arena_alloc(&cart->arena, capacity * sizeof(CartLine));
+    if (!lines)
+        return false;
+    if (cart->count > 0)
+        memcpy(lines, cart->lines, cart->count * sizeof(CartLine));
+    cart->lines = lines;
+    cart->capacity = capacity;
+    return true;
+}
+
+/**
+ * Suma unidades de un producto: si ya está en el carrito se acumulan en su
+ * línea, con el precio de la primera vez; si no, se abre una línea nueva.
+ *
+ * @return  false si no hay memoria o la cantidad o el total se desbordan
+ */
+bool cart_add(Cart *cart, const Product *prod, int qty) {
+    if (qty <= 0)
+        return false;
+    CartLine *found = NULL;
+    for (size_t i = 0; i < cart->count && !found; i++) {
+        if (cart->lines[i].ID == prod->ID)
+            found = &cart->lines[i];
+    }
+    Money amount, total;
+    int line_qty;
+    if (__builtin_mul_overflow(found ? found->unit_price : prod->price, (Money)qty, &amount) ||
+        __builtin_add_overflow(cart->total, amount, &total) ||
+        __builtin_add_overflow(found ? found->qty : 0, qty, &line_qty))
+        return false;
+    if (found) {
+        found->qty = line_qty;
+        cart->total = total;
+        return true;
+    }
+    if (cart->count == cart->capacity && !cart_grow(cart))
+        return false;
+    size_t len = strnlen(prod->product, sizeof(prod->product) - 1);
+    char *name = arena_alloc(&cart->arena, len + 1);
+    if (!name)
+        return false;
+    memcpy(name, prod->product, len);
+    name[len] = '\0';
+    CartLine *line = &cart->lines[cart->count++];
+    line->ID = prod->ID;
+    line->qty = qty;
+    line->unit_price = prod->price;
+    line->name = name;
+    cart->total = total;
+    return true;
+}
+
+/* Cierra la venta: olvida las líneas y devuelve la memoria a la arena. */
+void cart_reset(Cart *cart) {
+    arena_reset(&cart->arena);
+    cart->lines = NULL;
+    cart->count = 0;
+    cart->capacity = 0;
+    cart->total = 0;
+}
+
+void cart_free(Cart *cart) {
+    arena_free(&cart->arena);
+    cart_init(cart);
+}
@@ -0,0 +1,54 @@
+/*
+  Carrito de la venta en curso.
+
+  Cada producto ocupa una sola línea (referencia, cantidad y precio unitario)
+  por muchas unidades que se vendan, y todo lo que la venta necesita sale de
+  una arena: añadir una línea es avanzar un puntero y cerrar la venta libera
+  todo de golpe con cart_reset(). No hay límite de líneas ni de unidades.
+*/
+#ifndef CART_H
+#define CART_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "catalog.h"
+#include "money.h"
+
+// ---------------------------------------------------------------------------
+// Arena por venta
+// ---------------------------------------------------------------------------
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;         // Bloque en uso; los anteriores van detrás
+} Arena;
+
+void *arena_alloc(Arena *arena, size_t size);
+void  arena_reset(Arena *arena);
+void  arena_free(Arena *arena);
+
+// ---------------------------------------------------------------------------
+// Líneas del carrito
+// ---------------------------------------------------------------------------
+typedef struct {
+    int         ID;
+    int         qty;
+    Money       unit_price;   // Céntimos
+    const char *name;         // Copia del nombre en la arena
+} CartLine;
+
+typedef struct {
+    Arena      arena;
+    CartLine  *lines;
+    size_t     count;
+    size_t     capacity;
+    Money      total;         // Suma de cantidad x precio de las líneas
+} Cart;
+
+void   cart_init(Cart *cart);
+bool   cart_add(Cart *cart, const Product *prod, int qty);
+void   cart_reset(Cart *cart);
+void   cart_free(Cart *cart);
+
+#endif
@@ -0,0 +1,1835 @@
+/*
+  Motor de catálogo de productos: proyección mmap de products.dat (registros
+  calientes) y products.cold (textos), diccionarios de products.dict en
+  memoria e índices hash (direccionamiento abierto, sondeo lineal) sobre el
+  ID y el EAN-13.
+
+  Los borrados marcan el registro como lápida en su sitio; un hilo de
+  compactación reescribe los ficheros sin los registros muertos cuando la
+  proporción de lápidas supera compact_ratio.
+
+  El fichero lleva una CatalogHeader versionada y, tras un cierre limpio, una
+  copia de los índices para que la siguiente apertura no tenga que recorrerlo.
+*/
+
+#include "catalog.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CATALOG_MIN_CAPACITY 1024
+#define COMPACT_MIN_DEAD     64     // No merece la pena compactar por menos
+#define COMPACT_CHUNK        1024   // Registros copiados por cada toma del cerrojo
+#define COMPACT_RETRIES      3
+#define MIGRATE_CHUNK        256    // Registros leídos por cada pread al migrar
+#define DICT_MIN_SLOTS       64
+
+#ifdef __APPLE__
+#define fdatasync fsync
+#endif
+
+// ---------------------------------------------------------------------------
+// Códigos EAN-13
+// ---------------------------------------------------------------------------
+/* Convierte un código de exactamente 13 dígitos en su valor entero. */
+bool ean13_pack(const char *code, uint64_t *out) {
+    uint64_t value = 0;
+    int digits = 0;
+    for (; *code; code++) {
+        if (*code < '0' || *code > '9')
+            return false;
+        if (++digits > 13)
+            return false;
+        value = value * 10 + (uint64_t)(*code - '0');
+    }
+    if (digits != 13)
+        return false;
+    *out = value;
+    return true;
+}
+
+static bool record_ean(const Product *prod, uint64_t *ean) {
+    // EAN13 es char[14]; un registro sin terminador no tiene código válido.
+    return memchr(prod->EAN13, '\0', sizeof(prod->EAN13)) != NULL &&
+           ean13_pack(prod->EAN13, ean);
+}
+
+// ---------------------------------------------------------------------------
+// Campos de texto de Product
+// ---------------------------------------------------------------------------
+typedef struct {
+    size_t offset;
+    size_t size;
+} TextField;
+
+#define TEXT_FIELD(name) { offsetof(Product, name), sizeof(((Product *)0)->name) }
+
+/*
+  Una entrada fría es un uint16_t con la longitud seguido de los campos de
+  texto de cold_fields, cada uno terminado en '\0'. El EAN13 se guarda
+  también como texto para devolver intacto un código que no sea de 13 dígitos.
+*/
+static const TextField cold_fields[] = {
+    TEXT_FIELD(EAN13),
+    TEXT_FIELD(product),
+    TEXT_FIELD(descripcion1),
+    TEXT_FIELD(descripcion2),
+    TEXT_FIELD(descripcion3),
+    TEXT_FIELD(descripcion4),
+};
+
+// Columnas de diccionario, en el orden de CatalogDictColumn.
+static const TextField dict_fields[CATALOG_DICT_COLUMNS] = {
+    TEXT_FIELD(fabricante),
+    TEXT_FIELD(proveedor),
+    TEXT_FIELD(departamento),
+    TEXT_FIELD(clase),
+    TEXT_FIELD(subclase),
+    TEXT_FIELD(tipo_IVA),
+};
+
+#define COLD_FIELD_COUNT (sizeof(cold_fields) / sizeof(cold_fields[0]))
+#define COLD_ENTRY_MAX   1024
+
+static inline size_t field_length(const Product *prod, const TextField *field) {
+    return strnlen((const char *)prod + field->offset, field->size - 1);
+}
+
+/* Codifica los textos libres del producto en 'buf'; devuelve la longitud total de la entrada. */
+static size_t cold_encode(const Product *prod, char *buf) {
+    char *p = buf + sizeof(uint16_t);
+    for (size_t i = 0; i < COLD_FIELD_COUNT; i++) {
+        size_t len = field_length(prod, &cold_fields[i]);
+        memcpy(p, (const char *)prod + cold_fields[i].offset, len);
+        p[len] = '\0';
+        p += len + 1;
+    }
+    uint16_t body = (uint16_t)(p - buf - sizeof(uint16_t));
+    memcpy(buf, &body, sizeof(body));
+    return (size_t)(p - buf);
+}
+
+/* Longitud total de la entrada fría en 'offset', o 0 si no cabe en el fichero. */
+static size_t cold_entry_size(const char *cold, size_t cold_size, uint32_t offset) {
+    uint16_t body;
+    if (offset == 0 || (size_t)offset + sizeof(body) > cold_size)
+        return 0;
+    memcpy(&body, cold + offset, sizeof(body));
+    if ((size_t)offset + sizeof(body) + body > cold_size)
+        return 0;
+    return sizeof(body) + body;
+}
+
+static void cold_decode(const char *cold, size_t cold_size, uint32_t offset,
+                        const TextField *fields, size_t field_count, Product *out) {
+    size_t size = cold_entry_size(cold, cold_size, offset);
+    if (size == 0) return;
+    const char *p = cold + offset + sizeof(uint16_t);
+    const char *end = cold + offset + size;
+    for (size_t i = 0; i < field_count && p < end; i++) {
+        const char *nul = memchr(p, '\0', (size_t)(end - p));
+        size_t len = nul ? (size_t)(nul - p) : (size_t)(end - p);
+        size_t copy = len < fields[i].size - 1 ? len : fields[i].size - 1;
+        memcpy((char *)out + fields[i].offset, p, copy);
+        p += len + 1;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Diccionarios
+// ---------------------------------------------------------------------------
+/*
+  products.dict guarda, tras su cabecera, una entrada por valor distinto:
+  uint8_t columna, uint8_t longitud y el texto sin terminador. El código de
+  un valor es su orden de aparición dentro de la columna, empezando en 1.
+*/
+static inline uint32_t hash_text(const char *text, size_t len) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline bool dict_matches(const DictColumn *col, uint16_t code, const char *value, size_t len) {
+    const char *stored = col->values[code - 1];
+    return strncmp(stored, value, len) == 0 && stored[len] == '\0';
+}
+
+/* Código del valor, 0 para la cadena vacía o -1 si no está en el diccionario. */
+static int dict_find(const DictColumn *col, const char *value, size_t len) {
+    if (len == 0) return 0;
+    if (col->slot_capacity == 0) return -1;
+    size_t mask = col->slot_capacity - 1;
+    for (size_t i = hash_text(value, len) & mask; col->slots[i] != 0; i = (i + 1) & mask) {
+        if (dict_matches(col, col->slots[i], value, len))
+            return col->slots[i];
+    }
+    return -1;
+}
+
+static bool dict_rehash(DictColumn *col, size_t slot_capacity) {
+    uint16_t *slots = calloc(slot_capacity, sizeof(uint16_t));
+    if (!slots) return false;
+    size_t mask = slot_capacity - 1;
+    for (uint32_t code = 1; code <= col->count; code++) {
+        const char *value = col->values[code - 1];
+        size_t i = hash_text(value, strlen(value)) & mask;
+        while (slots[i] != 0)
+            i = (i + 1) & mask;
+        slots[i] = (uint16_t)code;
+    }
+    free(col->slots);
+    col->slots = slots;
+    col->slot_capacity = slot_capacity;
+    return true;
+}
+
+/* Añade el valor con el siguiente código, sin comprobar si ya existía. */
+static int dict_push(DictColumn *col, const char *value, size_t len) {
+    if (col->count >= CATALOG_DICT_MAX_CODE) return -1;
+    if (col->count == col->capacity) {
+        uint32_t capacity = col->capacity ? col->capacity * 2 : 16;
+        char **values = realloc(col->values, capacity * sizeof(char *));
+        if (!values) return -1;
+        col->values = values;
+        col->capacity = capacity;
+    }
+    char *copy = malloc(len + 1);
+    if (!copy) return -1;
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+    col->values[col->count++] = copy;
+    if ((col->count + 1) * 2 > col->slot_capacity) {
+        size_t slot_capacity = col->slot_capacity ? col->slot_capacity : DICT_MIN_SLOTS;
+        while ((col->count + 1) * 2 > slot_capacity)
+            slot_capacity <<= 1;
+        if (!dict_rehash(col, slot_capacity)) {
+            free(col->values[--col->count]);
+            return -1;
+        }
+        return (int)col->count;
+    }
+    size_t mask = col->slot_capacity - 1;
+    size_t i = hash_text(copy, len) & mask;
+    while (col->slots[i] != 0) {
+        if (dict_matches(col, col->slots[i], copy, len))
+            return (int)col->count; // Duplicado en el fichero: se resuelve al primero
+        i = (i + 1) & mask;
+    }
+    col->slots[i] = (uint16_t)col->count;
+    return (int)col->count;
+}
+
+/* Devuelve el código del valor, añadiéndolo si es nuevo (*added = true); -1 si no cabe. */
+static int dict_intern(DictColumn *col, const char *value, size_t len, bool *added) {
+    *added = false;
+    int code = dict_find(col, value, len);
+    if (code >= 0) return code;
+    code = dict_push(col, value, len);
+    *added = code > 0;
+    return code;
+}
+
+/* Descarta los valores añadidos a partir de 'count' (alta que no llegó al fichero). */
+static void dict_truncate(DictColumn *col, uint32_t count) {
+    if (col->count <= count) return;
+    while (col->count > count)
+        free(col->values[--col->count]);
+    if (!dict_rehash(col, col->slot_capacity)) {
+        // Sin memoria para reconstruir la tabla: la vaciamos, las búsquedas fallarán limpiamente.
+        memset(col->slots, 0, col->slot_capacity * sizeof(uint16_t));
+    }
+}
+
+static void dict_free(DictColumn *dict) {
+    for (int c = 0; c < CATALOG_DICT_COLUMNS; c++) {
+        for (uint32_t i = 0; i < dict[c].count; i++)
+            free(dict[c].values[i]);
+        free(dict[c].values);
+        free(dict[c].slots);
+        memset(&dict[c], 0, sizeof(dict[c]));
+    }
+}
+
+/* Rellena los códigos de diccionario del registro; false si alguna columna está llena. */
+static bool dict_encode(DictColumn *dict, const Product *prod, HotProduct *hot) {
+    for (int c = 0; c < CATALOG_DICT_COLUMNS; c++) {
+        bool added;
+        const char *value = (const char *)prod + dict_fields[c].offset;
+        int code = dict_intern(&dict[c], value, field_length(prod, &dict_fields[c]), &added);
+        if (code < 0) return false;
+        hot->dict[c] = (uint16_t)code;
+    }
+    return true;
+}
+
+static size_t dict_entry_encode(int column, const char *value, char *buf) {
+    size_t len = strlen(value);
+    buf[0] = (char)column;
+    buf[1] = (char)len;
+    memcpy(buf + 2, value, len);
+    return len + 2;
+}
+
+/* Carga las entradas del fichero; una entrada final incompleta se ignora. */
+static bool dict_load(DictColumn *dict, const char *data, size_t size, size_t *valid) {
+    size_t pos = sizeof(ColdHeader);
+    while (pos + 2 <= size) {
+        unsigned column = (unsigned char)data[pos];
+        size_t len = (unsigned char)data[pos + 1];
+        if (column >= CATALOG_DICT_COLUMNS || pos + 2 + len > size)
+            break;
+        if (dict_push(&dict[column], data + pos + 2, len) < 0)
+            return false;
+        pos += 2 + len;
+    }
+    *valid = pos;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Registros calientes
+// ---------------------------------------------------------------------------
+static inline bool price_fits(Money price) {
+    return price >= -(Money)CATALOG_PRICE_MAX && price <= CATALOG_PRICE_MAX;
+}
+
+/* Falla si algún precio no cabe en los 32 bits del registro caliente. */
+static bool hot_from_product(const Product *prod, uint32_t cold_offset, HotProduct *hot) {
+    if (!price_fits(prod->price) || !price_fits(prod->price01) || !price_fits(prod->price02) ||
+        !price_fits(prod->price03) || !price_fits(prod->price04))
+        return false;
+    memset(hot, 0, sizeof(*hot));
+    hot->ID = prod->ID;
+    hot->stock = prod->stock;
+    if (!record_ean(prod, &hot->ean))
+        hot->ean = 0;
+    hot->price = (int32_t)prod->price;
+    hot->price01 = (int32_t)prod->price01;
+    hot->price02 = (int32_t)prod->price02;
+    hot->price03 = (int32_t)prod->price03;
+    hot->price04 = (int32_t)prod->price04;
+    hot->cold_offset = cold_offset;
+    return true;
+}
+
+/* Reconstruye el Product completo a partir del registro caliente, sus textos y los diccionarios. */
+static void materialize(const Catalog *cat, size_t pos, Product *out) {
+    const HotProduct *hot = &cat->hot[pos];
+    memset(out, 0, sizeof(*out));
+    out->ID = hot->ID;
+    out->stock = hot->stock;
+    out->price = hot->price;
+    out->price01 = hot->price01;
+    out->price02 = hot->price02;
+    out->price03 = hot->price03;
+    out->price04 = hot->price04;
+    for (int c = 0; c < CATALOG_DICT_COLUMNS; c++) {
+        uint16_t code = hot->dict[c];
+        if (code == 0 || code > cat->dict[c].count)
+            continue;
+        const char *value = cat->dict[c].values[code - 1];
+        size_t len = strnlen(value, dict_fields[c].size - 1);
+        memcpy((char *)out + dict_fields[c].offset, value, len);
+    }
+    cold_decode(cat->cold, cat->cold_size, hot->cold_offset, cold_fields, COLD_FIELD_COUNT, out);
+}
+
+// ---------------------------------------------------------------------------
+// Índices hash por ID y por EAN-13
+// ---------------------------------------------------------------------------
+static inline uint32_t hash_id(uint32_t key) {
+    // Mezclador final de MurmurHash3: reparte bien IDs consecutivos.
+    key ^= key >> 16;
+    key *= 0x85ebca6bu;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35u;
+    key ^= key >> 16;
+    return key;
+}
+
+static inline uint64_t hash_ean(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+}
+
+/* ¿Está 'home' fuera del tramo cíclico (hole, j]? Entonces j puede ocupar el hueco. */
+static inline bool can_fill_hole(size_t home, size_t hole, size_t j) {
+    return hole <= j ? (home <= hole || home > j) : (home <= hole && home > j);
+}
+
+static void ean_insert(Catalog *cat, size_t pos) {
+    uint64_t ean = cat->hot[pos].ean;
+    if (ean == 0)
+        return;
+    size_t mask = cat->capacity - 1;
+    size_t i = hash_ean(ean) & mask;
+    while (cat->ean_slots[i].pos != 0) {
+        if (cat->ean_slots[i].ean == ean)
+            return;
+        i = (i + 1) & mask;
+    }
+    cat->ean_slots[i].ean = ean;
+    cat->ean_slots[i].pos = (uint32_t)pos + 1;
+    cat->ean_used++;
+}
+
+static void ean_erase(Catalog *cat, size_t pos) {
+    uint64_t ean = cat->hot[pos].ean;
+    if (ean == 0)
+        return;
+    size_t mask = cat->capacity - 1;
+    size_t i = hash_ean(ean) & mask;
+    while (cat->ean_slots[i].pos != 0 && cat->ean_slots[i].pos != pos + 1)
+        i = (i + 1) & mask;
+    if (cat->ean_slots[i].pos == 0)
+        return;
+    // Borrado por desplazamiento hacia atrás: no deja huecos en las cadenas de sondeo.
+    for (size_t j = (i + 1) & mask; cat->ean_slots[j].pos != 0; j = (j + 1) & mask) {
+        if (can_fill_hole(hash_ean(cat->ean_slots[j].ean) & mask, i, j)) {
+            cat->ean_slots[i] = cat->ean_slots[j];
+            i = j;
+        }
+    }
+    cat->ean_slots[i].pos = 0;
+    cat->ean_used--;
+}
+
+static void index_insert(Catalog *cat, size_t pos) {
+    if (HOT_IS_DELETED(&cat->hot[pos]))
+        return;
+    ean_insert(cat, pos);
+    size_t mask = cat->capacity - 1;
+    size_t i = hash_id((uint32_t)cat->hot[pos].ID) & mask;
+    while (cat->slots[i] != 0) {
+        // Si hay IDs repetidos se conserva el primero, como el antiguo recorrido secuencial.
+        if (cat->hot[cat->slots[i] - 1].ID == cat->hot[pos].ID)
+            return;
+        i = (i + 1) & mask;
+    }
+    cat->slots[i] = (uint32_t)pos + 1;
+    cat->used++;
+}
+
+static void index_erase(Catalog *cat, size_t pos) {
+    ean_erase(cat, pos);
+    size_t mask = cat->capacity - 1;
+    size_t i = hash_id((uint32_t)cat->hot[pos].ID) & mask;
+    while (cat->slots[i] != 0 && cat->slots[i] != pos + 1)
+        i = (i + 1) & mask;
+    if (cat->slots[i] == 0)
+        return;
+    for (size_t j = (i + 1) & mask; cat->slots[j] != 0; j = (j + 1) & mask) {
+        uint32_t home = hash_id((uint32_t)cat->hot[cat->slots[j] - 1].ID) & mask;
+        if (can_fill_hole(home, i, j)) {
+            cat->slots[i] = cat->slots[j];
+            i = j;
+        }
+    }
+    cat->slots[i] = 0;
+    cat->used--;
+}
+
+static bool index_build(Catalog *cat, size_t min_entries) {
+    size_t capacity = CATALOG_MIN_CAPACITY;
+    while (capacity < min_entries * 2)
+        capacity <<= 1;
+    uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+    EanSlot *ean_slots = calloc(capacity, sizeof(EanSlot));
+    if (!slots || !ean_slots) {
+        free(slots);
+        free(ean_slots);
+        return false;
+    }
+    free(cat->slots);
+    free(cat->ean_slots);
+    cat->slots = slots;
+    cat->ean_slots = ean_slots;
+    cat->capacity = capacity;
+    cat->used = 0;
+    cat->ean_used = 0;
+    cat->dead = 0;
+    for (size_t pos = 0; pos < cat->count; pos++) {
+        if (HOT_IS_DELETED(&cat->hot[pos]))
+            cat->dead++;
+        else
+            index_insert(cat, pos);
+    }
+    return true;
+}
+
+static long index_lookup(const Catalog *cat, int id) {
+    if (cat->capacity == 0) return -1;
+    size_t mask = cat->capacity - 1;
+    size_t i = hash_id((uint32_t)id) & mask;
+    while (cat->slots[i] != 0) {
+        size_t pos = cat->slots[i] - 1;
+        if (cat->hot[pos].ID == id)
+            return (long)pos;
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+static long ean_lookup(const Catalog *cat, uint64_t ean) {
+    if (cat->capacity == 0) return -1;
+    size_t mask = cat->capacity - 1;
+    size_t i = hash_ean(ean) & mask;
+    while (cat->ean_slots[i].pos != 0) {
+        if (cat->ean_slots[i].ean == ean)
+            return (long)cat->ean_slots[i].pos - 1;
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+// Sección de índice persistida
+// ---------------------------------------------------------------------------
+static size_t index_section_size(size_t capacity) {
+    return sizeof(CatalogIndexHeader) + capacity * sizeof(uint32_t) + capacity * sizeof(EanSlot);
+}
+
+static bool write_index(int fd, off_t offset, const Catalog *cat) {
+    CatalogIndexHeader ih;
+    memset(&ih, 0, sizeof(ih));
+    ih.hash_version = CATALOG_HASH_VERSION;
+    ih.capacity = cat->capacity;
+    ih.used = cat->used;
+    ih.ean_used = cat->ean_used;
+    size_t slots_size = cat->capacity * sizeof(uint32_t);
+    size_t ean_size = cat->capacity * sizeof(EanSlot);
+    return pwrite(fd, &ih, sizeof(ih), offset) == (ssize_t)sizeof(ih) &&
+           pwrite(fd, cat->slots, slots_size, offset + (off_t)sizeof(ih)) == (ssize_t)slots_size &&
+           pwrite(fd, cat->ean_slots, ean_size, offset + (off_t)(sizeof(ih) + slots_size)) == (ssize_t)ean_size;
+}
+
+static bool index_in_bounds(const uint32_t *slots, const EanSlot *ean_slots, size_t capacity, size_t count) {
+    for (size_t i = 0; i < capacity; i++) {
+        if (slots[i] > count || ean_slots[i].pos > count)
+            return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Escritura secuencial de un catálogo completo
+// ---------------------------------------------------------------------------
+/*
+  Escribe products.dat/products.cold de principio a fin y products.dict al
+  terminar. Lo usan la conversión desde CSV, la migración de formatos
+  anteriores y la compactación.
+*/
+struct CatalogWriter {
+    FILE     *hot;
+    FILE     *cold;
+    CatalogHeader header;
+    uint64_t  cold_size;
+    DictColumn dict[CATALOG_DICT_COLUMNS];
+    char     *dict_path;      // Solo en los writers de catalog_writer_create()
+};
+
+static void header_init(CatalogHeader *header, uint64_t count, uint64_t cold_id) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, CATALOG_MAGIC, sizeof(header->magic));
+    header->version = CATALOG_VERSION;
+    header->header_size = sizeof(CatalogHeader);
+    header->record_size = sizeof(HotProduct);
+    header->record_count = count;
+    header->cold_id = cold_id;
+}
+
+static bool write_companion_header(FILE *file, const char *magic, uint64_t cold_id) {
+    ColdHeader ch;
+    memcpy(ch.magic, magic, sizeof(ch.magic));
+    ch.cold_id = cold_id;
+    return fwrite(&ch, sizeof(ch), 1, file) == 1;
+}
+
+static bool writer_open(CatalogWriter *w, const char *hot_path, const char *cold_path, uint64_t cold_id) {
+    memset(w, 0, sizeof(*w));
+    header_init(&w->header, 0, cold_id);
+    w->hot = fopen(hot_path, "w+b");
+    w->cold = fopen(cold_path, "wb");
+    w->cold_size = sizeof(ColdHeader);
+    // La cabecera definitiva se escribe al final, cuando se conoce el recuento.
+    if (w->hot && w->cold &&
+        fwrite(&w->header, sizeof(w->header), 1, w->hot) == 1 &&
+        write_companion_header(w->cold, COLD_MAGIC, cold_id))
+        return true;
+    if (w->hot) fclose(w->hot);
+    if (w->cold) fclose(w->cold);
+    return false;
+}
+
+/* Añade un registro caliente, ya con sus códigos de diccionario, y su entrada fría codificada. */
+static bool writer_add_entry(CatalogWriter *w, HotProduct *hot, const char *entry, size_t size) {
+    hot->cold_offset = 0;
+    if (size > 0) {
+        if (w->cold_size + size > UINT32_MAX)
+            return false;
+        hot->cold_offset = (uint32_t)w->cold_size;
+        if (fwrite(entry, size, 1, w->cold) != 1)
+            return false;
+        w->cold_size += size;
+    }
+    if (fwrite(hot, sizeof(*hot), 1, w->hot) != 1)
+        return false;
+    w->header.record_count++;
+    if (HOT_IS_DELETED(hot))
+        w->header.dead_count++;
+    return true;
+}
+
+static bool writer_add(CatalogWriter *w, const Product *prod) {
+    char entry[COLD_ENTRY_MAX];
+    HotProduct hot;
+    if (!hot_from_product(prod, 0, &hot) || !dict_encode(w->dict, prod, &hot))
+        return false;
+    return writer_add_entry(w, &hot, entry, cold_encode(prod, entry));
+}
+
+static bool write_dict_file(const char *path, const DictColumn *dict, uint64_t cold_id) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return false;
+    bool ok = write_companion_header(file, DICT_MAGIC, cold_id);
+    char entry[2 + 255];
+    for (int c = 0; c < CATALOG_DICT_COLUMNS && ok; c++) {
+        for (uint32_t i = 0; i < dict[c].count && ok; i++) {
+            size_t size = dict_entry_encode(c, dict[c].values[i], entry);
+            ok = fwrite(entry, size, 1, file) == 1;
+        }
+    }
+    if (ok) ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0) ok = false;
+    return ok;
+}
+
+/*
+  Cierra los ficheros y escribe el diccionario. Con with_index, proyecta lo
+  escrito y persiste los índices para que la primera apertura sea inmediata.
+*/
+static bool writer_finish(CatalogWriter *w, const char *dict_path, bool with_index) {
+    bool ok = fflush(w->hot) == 0 && fflush(w->cold) == 0;
+    int fd = fileno(w->hot);
+    if (ok && with_index && w->header.record_count > 0) {
+        size_t count = (size_t)w->header.record_count;
+        size_t size = sizeof(CatalogHeader) + count * sizeof(HotProduct);
+        void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        ok = map != MAP_FAILED;
+        if (ok) {
+            Catalog cat;
+            memset(&cat, 0, sizeof(cat));
+            cat.hot = (HotProduct *)((char *)map + sizeof(CatalogHeader));
+            cat.count = count;
+            off_t offset = ((off_t)size + 7) & ~(off_t)7;
+            ok = index_build(&cat, count) && write_index(fd, offset, &cat);
+            if (ok) {
+                w->header.index_offset = (uint64_t)offset;
+                w->header.index_size = index_section_size(cat.capacity);
+            }
+            free(cat.slots);
+            free(cat.ean_slots);
+            munmap(map, size);
+        }
+    }
+    if (ok) ok = write_dict_file(dict_path, w->dict, w->header.cold_id);
+    if (ok) ok = pwrite(fd, &w->header, sizeof(w->header), 0) == (ssize_t)sizeof(w->header);
+    if (ok) ok = fsync(fd) == 0 && fsync(fileno(w->cold)) == 0;
+    if (fclose(w->hot) != 0) ok = false;
+    if (fclose(w->cold) != 0) ok = false;
+    dict_free(w->dict);
+    return ok;
+}
+
+static void writer_abort(CatalogWriter *w) {
+    fclose(w->hot);
+    fclose(w->cold);
+    dict_free(w->dict);
+}
+
+// ---------------------------------------------------------------------------
+// Cabecera y proyección de los ficheros
+// ---------------------------------------------------------------------------
+static void set_error(Catalog *cat, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(cat->error, sizeof(cat->error), fmt, ap);
+    va_end(ap);
+}
+
+static inline off_t record_offset(const Catalog *cat, size_t pos) {
+    return (off_t)(cat->data_offset + pos * sizeof(HotProduct));
+}
+
+static bool write_header(Catalog *cat) {
+    return pwrite(cat->fd, &cat->header, sizeof(cat->header), 0) == (ssize_t)sizeof(cat->header);
+}
+
+/* Antes de que un alta o una baja toque el fichero, el índice persistido deja de valer. */
+static bool invalidate_index(Catalog *cat) {
+    if (cat->header.index_offset == 0)
+        return true;
+    cat->header.index_offset = 0;
+    cat->header.index_size = 0;
+    return write_header(cat);
+}
+
+static void unmap(Catalog *cat) {
+    if (cat->map)
+        munmap(cat->map, cat->map_size);
+    if (cat->cold)
+        munmap(cat->cold, cat->cold_size);
+    cat->map = NULL;
+    cat->hot = NULL;
+    cat->map_size = 0;
+    cat->count = 0;
+    cat->cold = NULL;
+    cat->cold_size = 0;
+}
+
+static bool map_cold(Catalog *cat) {
+    if (cat->cold)
+        munmap(cat->cold, cat->cold_size);
+    cat->cold = NULL;
+    cat->cold_size = 0;
+    struct stat st;
+    if (fstat(cat->cold_fd, &st) != 0) return false;
+    if (st.st_size == 0) return true;
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, cat->cold_fd, 0);
+    if (map == MAP_FAILED) return false;
+    cat->cold = map;
+    cat->cold_size = (size_t)st.st_size;
+    return true;
+}
+
+/* Proyecta cabecera y registros calientes (sin la sección de índice) y el fichero frío. */
+static bool remap(Catalog *cat) {
+    if (cat->map)
+        munmap(cat->map, cat->map_size);
+    cat->map = NULL;
+    cat->hot = NULL;
+    cat->map_size = 0;
+    cat->count = 0;
+    size_t count = (size_t)cat->header.record_count;
+    if (count > 0) {
+        size_t size = cat->data_offset + count * sizeof(HotProduct);
+        void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, cat->fd, 0);
+        if (map == MAP_FAILED) return false;
+        cat->map = map;
+        cat->hot = (HotProduct *)((char *)map + cat->data_offset);
+        cat->map_size = size;
+        cat->count = count;
+    }
+    return map_cold(cat);
+}
+
+static char *suffixed_name(const char *filename, const char *suffix) {
+    size_t len = strlen(filename);
+    size_t extra = strlen(suffix);
+    char *name = malloc(len + extra + 1);
+    if (!name) return NULL;
+    memcpy(name, filename, len);
+    memcpy(name + len, suffix, extra + 1);
+    return name;
+}
+
+/* products.dat -> products.cold / products.dict; cualquier otro nombre recibe el sufijo */
+static char *companion_name(const char *filename, const char *extension) {
+    size_t len = strlen(filename);
+    if (len > 4 && strcmp(filename + len - 4, ".dat") == 0) {
+        size_t extra = strlen(extension);
+        char *name = malloc(len - 4 + extra + 1);
+        if (!name) return NULL;
+        memcpy(name, filename, len - 4);
+        memcpy(name + len - 4, extension, extra + 1);
+        return name;
+    }
+    return suffixed_name(filename, extension);
+}
+
+static bool read_cold_id(const char *path, const char *magic, uint64_t *cold_id) {
+    ColdHeader ch;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = pread(fd, &ch, sizeof(ch), 0) == (ssize_t)sizeof(ch) &&
+              memcmp(ch.magic, magic, sizeof(ch.magic)) == 0;
+    close(fd);
+    if (ok) *cold_id = ch.cold_id;
+    return ok;
+}
+
+/*
+  Sustituye los ficheros por los temporales. El caliente se renombra
+  primero: si se corta entre un rename y otro, open_companion() encuentra el
+  temporal con el cold_id que espera la cabecera y termina el trabajo. Por
+  eso, con *hot_installed a true los temporales no se deben borrar aunque
+  falle el resto.
+*/
+static bool install_files(Catalog *cat, const char *hot_tmp, const char *cold_tmp, const char *dict_tmp,
+                          bool *hot_installed) {
+    *hot_installed = rename(hot_tmp, cat->filename) == 0;
+    return *hot_installed && rename(cold_tmp, cat->cold_filename) == 0 &&
+           rename(dict_tmp, cat->dict_filename) == 0;
+}
+
+/* Abre products.cold o products.dict comprobando que su cold_id es el de la cabecera. */
+static int open_companion(Catalog *cat, const char *path, const char *magic) {
+    uint64_t cold_id = 0;
+    if (!read_cold_id(path, magic, &cold_id) || cold_id != cat->header.cold_id) {
+        char *tmp = suffixed_name(path, ".tmp");
+        uint64_t tmp_id = 0;
+        bool recovered = tmp && !cat->readonly && read_cold_id(tmp, magic, &tmp_id) &&
+                         tmp_id == cat->header.cold_id && rename(tmp, path) == 0;
+        free(tmp);
+        if (!recovered && cat->header.record_count == 0 && !cat->readonly) {
+            FILE *file = fopen(path, "wb");
+            recovered = file && write_companion_header(file, magic, cat->header.cold_id);
+            if (file && fclose(file) != 0) recovered = false;
+        }
+        if (!recovered) {
+            set_error(cat, "'%s' missing or does not match the catalog", path);
+            return -1;
+        }
+    }
+    int fd = open(path, cat->readonly ? O_RDONLY : O_RDWR);
+    if (fd < 0)
+        set_error(cat, "cannot open '%s'", path);
+    return fd;
+}
+
+/* Lee products.dict entero; las altas posteriores se añaden tras la última entrada completa. */
+static bool load_dict_fd(Catalog *cat, int fd) {
+    dict_free(cat->dict);
+    struct stat st;
+    if (fstat(fd, &st) != 0) return false;
+    size_t size = (size_t)st.st_size;
+    char *data = malloc(size ? size : 1);
+    bool ok = data && pread(fd, data, size, 0) == (ssize_t)size &&
+              dict_load(cat->dict, data, size, &cat->dict_size);
+    free(data);
+    if (!ok) set_error(cat, "cannot load dictionary '%s'", cat->dict_filename);
+    return ok;
+}
+
+static bool open_companions(Catalog *cat) {
+    cat->cold_fd = open_companion(cat, cat->cold_filename, COLD_MAGIC);
+    if (cat->cold_fd < 0) return false;
+    int fd = open_companion(cat, cat->dict_filename, DICT_MAGIC);
+    if (fd < 0) return false;
+    bool ok = load_dict_fd(cat, fd);
+    if (cat->readonly)
+        close(fd);
+    else
+        cat->dict_fd = fd;
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Migración de formatos anteriores
+// ---------------------------------------------------------------------------
+/*
+  La migración escribe un catálogo nuevo con el CatalogWriter y lo instala
+  en lugar del antiguo. En solo lectura va a ficheros temporales anónimos
+  que se abren y se desenlazan en el acto, y el original no se toca.
+*/
+typedef struct {
+    CatalogWriter w;
+    char *hot_tmp;
+    char *cold_tmp;
+    char *dict_tmp;
+} Migration;
+
+static char *temp_file(const char *prefix) {
+    char *name = suffixed_name(prefix, "XXXXXX");
+    if (!name) return NULL;
+    int fd = mkstemp(name);
+    if (fd < 0) {
+        free(name);
+        return NULL;
+    }
+    close(fd);
+    return name;
+}
+
+static bool migration_begin(Catalog *cat, Migration *m) {
+    memset(m, 0, sizeof(*m));
+    if (cat->readonly) {
+        m->hot_tmp = temp_file("/tmp/poscat-");
+        m->cold_tmp = temp_file("/tmp/poscold-");
+        m->dict_tmp = temp_file("/tmp/posdict-");
+    } else {
+        m->hot_tmp = suffixed_name(cat->filename, ".tmp");
+        m->cold_tmp = suffixed_name(cat->cold_filename, ".tmp");
+        m->dict_tmp = suffixed_name(cat->dict_filename, ".tmp");
+    }
+    return m->hot_tmp && m->cold_tmp && m->dict_tmp &&
+           writer_open(&m->w, m->hot_tmp, m->cold_tmp, (uint64_t)time(NULL));
+}
+
+/* Cierra el writer e instala (o abre, en solo lectura) el resultado. */
+static bool migration_end(Catalog *cat, Migration *m, bool begun, bool ok) {
+    if (begun && ok) ok = writer_finish(&m->w, m->dict_tmp, false);
+    else if (begun) writer_abort(&m->w);
+    ok = ok && begun;
+    int fd = -1;
+    bool installed = false;
+    if (ok && cat->readonly) {
+        fd = open(m->hot_tmp, O_RDONLY);
+        cat->cold_fd = open(m->cold_tmp, O_RDONLY);
+        int dict_fd = open(m->dict_tmp, O_RDONLY);
+        ok = fd >= 0 && cat->cold_fd >= 0 && dict_fd >= 0 && load_dict_fd(cat, dict_fd);
+        if (dict_fd >= 0) close(dict_fd);
+    } else if (ok) {
+        ok = install_files(cat, m->hot_tmp, m->cold_tmp, m->dict_tmp, &installed);
+        if (ok) fd = open(cat->filename, O_RDWR);
+        ok = ok && fd >= 0;
+    }
+    if (cat->readonly || (!ok && !installed)) {
+        if (m->hot_tmp) remove(m->hot_tmp);
+        if (m->cold_tmp) remove(m->cold_tmp);
+        if (m->dict_tmp) remove(m->dict_tmp);
+    }
+    free(m->hot_tmp);
+    free(m->cold_tmp);
+    free(m->dict_tmp);
+    if (!ok) {
+        if (fd >= 0) close(fd);
+        set_error(cat, "cannot migrate catalog to version %d", CATALOG_VERSION);
+        return false;
+    }
+    close(cat->fd);
+    cat->fd = fd;
+    return pread(fd, &cat->header, sizeof(cat->header), 0) == (ssize_t)sizeof(cat->header);
+}
+
+// Product completo de la versión 1 y de los volcados sin cabecera: precios en float.
+typedef struct {
+    int    ID;
+    char   EAN13[14];
+    char   product[100];
+    float  price;
+    int    stock;
+    float  price01;
+    float  price02;
+    float  price03;
+    float  price04;
+    char   fabricante[50];
+    char   proveedor[50];
+    char   departamento[50];
+    char   clase[50];
+    char   subclase[50];
+    char   tipo_IVA[20];
+    char   descripcion1[100];
+    char   descripcion2[100];
+    char   descripcion3[100];
+    char   descripcion4[100];
+} ProductV1;
+
+/* Precio en float de un formato anterior; lo que no cabe en el registro caliente se satura. */
+static Money legacy_price(float value) {
+    if (isnan(value))
+        return 0;
+    if (value >= CATALOG_PRICE_MAX / 100.0f)
+        return CATALOG_PRICE_MAX;
+    if (value <= -CATALOG_PRICE_MAX / 100.0f)
+        return -(Money)CATALOG_PRICE_MAX;
+    return money_from_float(value);
+}
+
+#define COPY_TEXT(dst, src, name) memcpy((dst)->name, (src)->name, sizeof((dst)->name))
+
+static void product_from_v1(const ProductV1 *old, Product *prod) {
+    memset(prod, 0, sizeof(*prod));
+    prod->ID = old->ID;
+    prod->stock = old->stock;
+    prod->price = legacy_price(old->price);
+    prod->price01 = legacy_price(old->price01);
+    prod->price02 = legacy_price(old->price02);
+    prod->price03 = legacy_price(old->price03);
+    prod->price04 = legacy_price(old->price04);
+    COPY_TEXT(prod, old, EAN13);
+    COPY_TEXT(prod, old, product);
+    COPY_TEXT(prod, old, fabricante);
+    COPY_TEXT(prod, old, proveedor);
+    COPY_TEXT(prod, old, departamento);
+    COPY_TEXT(prod, old, clase);
+    COPY_TEXT(prod, old, subclase);
+    COPY_TEXT(prod, old, tipo_IVA);
+    COPY_TEXT(prod, old, descripcion1);
+    COPY_TEXT(prod, old, descripcion2);
+    COPY_TEXT(prod, old, descripcion3);
+    COPY_TEXT(prod, old, descripcion4);
+}
+
+/* Versión 1, o volcado antiguo sin cabecera: registros Product completos. */
+static bool migrate_full_records(Catalog *cat, size_t offset, uint64_t count) {
+    Migration m;
+    bool begun = migration_begin(cat, &m);
+    bool ok = begun;
+    if (ok) {
+        ProductV1 buf[MIGRATE_CHUNK];
+        for (uint64_t done = 0; ok && done < count;) {
+            size_t chunk = count - done < MIGRATE_CHUNK ? (size_t)(count - done) : MIGRATE_CHUNK;
+            ssize_t bytes = (ssize_t)(chunk * sizeof(ProductV1));
+            ok = pread(cat->fd, buf, (size_t)bytes, (off_t)(offset + done * sizeof(ProductV1))) == bytes;
+            for (size_t i = 0; ok && i < chunk; i++) {
+                if (buf[i].ID < 0)
+                    continue; // Lápida de la versión 1 (bit de signo del ID)
+                Product prod;
+                product_from_v1(&buf[i], &prod);
+                ok = writer_add(&m.w, &prod);
+            }
+            done += chunk;
+        }
+    }
+    return migration_end(cat, &m, begun, ok);
+}
+
+// Registro caliente de la versión 2: los textos de diccionario iban en products.cold.
+typedef struct {
+    int32_t   ID;
+    int32_t   stock;
+    uint64_t  ean;
+    float     price;
+    float     price01;
+    float     price02;
+    float     price03;
+    float     price04;
+    uint32_t  cold_offset;
+    char      tipo_IVA[16];
+    uint32_t  flags;
+    uint32_t  reserved;
+} HotProductV2;
+
+static const TextField cold_fields_v2[] = {
+    TEXT_FIELD(EAN13),
+    TEXT_FIELD(product),
+    TEXT_FIELD(fabricante),
+    TEXT_FIELD(proveedor),
+    TEXT_FIELD(departamento),
+    TEXT_FIELD(clase),
+    TEXT_FIELD(subclase),
+    TEXT_FIELD(descripcion1),
+    TEXT_FIELD(descripcion2),
+    TEXT_FIELD(descripcion3),
+    TEXT_FIELD(descripcion4),
+};
+
+/* Versión 2: registros calientes de 64 bytes con todos los textos en products.cold. */
+static bool migrate_v2(Catalog *cat) {
+    uint64_t cold_id = 0;
+    if (cat->header.record_size != sizeof(HotProductV2) ||
+        (cat->header.record_count > 0 &&
+         (!read_cold_id(cat->cold_filename, COLD_MAGIC, &cold_id) || cold_id != cat->header.cold_id))) {
+        set_error(cat, "version 2 catalog is incomplete ('%s' missing or does not match)",
+                  cat->cold_filename);
+        return false;
+    }
+    int cold_fd = open(cat->cold_filename, O_RDONLY);
+    struct stat st;
+    char *cold = NULL;
+    size_t cold_size = 0;
+    if (cold_fd >= 0 && fstat(cold_fd, &st) == 0 && st.st_size > 0) {
+        cold_size = (size_t)st.st_size;
+        cold = mmap(NULL, cold_size, PROT_READ, MAP_SHARED, cold_fd, 0);
+        if (cold == MAP_FAILED) cold = NULL;
+    }
+    Migration m;
+    bool begun = migration_begin(cat, &m);
+    bool ok = begun && (cold != NULL || cat->header.record_count == 0);
+    uint64_t count = cat->header.record_count;
+    HotProductV2 buf[MIGRATE_CHUNK];
+    for (uint64_t done = 0; ok && done < count;) {
+        size_t chunk = count - done < MIGRATE_CHUNK ? (size_t)(count - done) : MIGRATE_CHUNK;
+        ssize_t bytes = (ssize_t)(chunk * sizeof(HotProductV2));
+        ok = pread(cat->fd, buf, (size_t)bytes, (off_t)(cat->header.header_size + done * sizeof(HotProductV2))) == bytes;
+        for (size_t i = 0; ok && i < chunk; i++) {
+            const HotProductV2 *old = &buf[i];
+            if (old->flags & HOT_DELETED)
+                continue;
+            Product prod;
+            memset(&prod, 0, sizeof(prod));
+            prod.ID = old->ID;
+            prod.stock = old->stock;
+            prod.price = legacy_price(old->price);
+            prod.price01 = legacy_price(old->price01);
+            prod.price02 = legacy_price(old->price02);
+            prod.price03 = legacy_price(old->price03);
+            prod.price04 = legacy_price(old->price04);
+            memcpy(prod.tipo_IVA, old->tipo_IVA, strnlen(old->tipo_IVA, sizeof(old->tipo_IVA)));
+            cold_decode(cold, cold_size, old->cold_offset, cold_fields_v2,
+                        sizeof(cold_fields_v2) / sizeof(cold_fields_v2[0]), &prod);
+            ok = writer_add(&m.w, &prod);
+        }
+        done += chunk;
+    }
+    if (cold) munmap(cold, cold_size);
+    if (cold_fd >= 0) close(cold_fd);
+    return migration_end(cat, &m, begun, ok);
+}
+
+// Registro caliente de la versión 3: igual que el actual, con los precios en float.
+typedef struct {
+    int32_t   ID;
+    int32_t   stock;
+    uint64_t  ean;
+    float     price;
+    float     price01;
+    float     price02;
+    float     price03;
+    float     price04;
+    uint32_t  cold_offset;
+    uint16_t  dict[CATALOG_DICT_COLUMNS];
+    uint32_t  flags;
+    uint32_t  reserved[2];
+} HotProductV3;
+
+_Static_assert(sizeof(HotProductV3) == sizeof(HotProduct), "la versión 3 se convierte registro a registro");
+
+/*
+  Versión 3: solo cambian los precios de los registros calientes, así que
+  products.cold y products.dict se quedan como están (con el mismo cold_id)
+  y basta reescribir products.dat.
+*/
+static bool migrate_v3(Catalog *cat, off_t file_size) {
+    if (cat->header.record_size != sizeof(HotProductV3) || cat->header.header_size < sizeof(CatalogHeader)) {
+        set_error(cat, "version 3 record size %u does not match (%zu)",
+                  cat->header.record_size, sizeof(HotProductV3));
+        return false;
+    }
+    uint64_t count = cat->header.record_count;
+    uint64_t fits = ((uint64_t)file_size - cat->header.header_size) / sizeof(HotProductV3);
+    if (count > fits) count = fits;
+
+    char *tmp = cat->readonly ? temp_file("/tmp/poscat-") : suffixed_name(cat->filename, ".tmp");
+    FILE *out = tmp ? fopen(tmp, "wb") : NULL;
+    CatalogHeader header;
+    header_init(&header, count, cat->header.cold_id);
+    header.dead_count = cat->header.dead_count;
+    bool ok = out && fwrite(&header, sizeof(header), 1, out) == 1;
+    HotProductV3 buf[MIGRATE_CHUNK];
+    for (uint64_t done = 0; ok && done < count;) {
+        size_t chunk = count - done < MIGRATE_CHUNK ? (size_t)(count - done) : MIGRATE_CHUNK;
+        ssize_t bytes = (ssize_t)(chunk * sizeof(HotProductV3));
+        ok = pread(cat->fd, buf, (size_t)bytes,
+                   (off_t)(cat->header.header_size + done * sizeof(HotProductV3))) == bytes;
+        HotProduct hot[MIGRATE_CHUNK];
+        for (size_t i = 0; ok && i < chunk; i++) {
+            const HotProductV3 *old = &buf[i];
+            memset(&hot[i], 0, sizeof(hot[i]));
+            hot[i].ID = old->ID;
+            hot[i].stock = old->stock;
+            hot[i].ean = old->ean;
+            hot[i].cold_offset = old->cold_offset;
+            memcpy(hot[i].dict, old->dict, sizeof(hot[i].dict));
+            hot[i].flags = old->flags;
+            hot[i].price = (int32_t)legacy_price(old->price);
+            hot[i].price01 = (int32_t)legacy_price(old->price01);
+            hot[i].price02 = (int32_t)legacy_price(old->price02);
+            hot[i].price03 = (int32_t)legacy_price(old->price03);
+            hot[i].price04 = (int32_t)legacy_price(old->price04);
+        }
+        ok = ok && fwrite(hot, sizeof(HotProduct), chunk, out) == chunk;
+        done += chunk;
+    }
+    if (out) {
+        ok = fflush(out) == 0 && fdatasync(fileno(out)) == 0 && ok;
+        ok = fclose(out) == 0 && ok;
+    }
+
+    int fd = -1;
+    if (ok && cat->readonly) {
+        fd = open(tmp, O_RDONLY);
+    } else if (ok) {
+        ok = rename(tmp, cat->filename) == 0;
+        if (ok) fd = open(cat->filename, O_RDWR);
+    }
+    if (tmp && (cat->readonly || !ok)) remove(tmp);
+    free(tmp);
+    if (!ok || fd < 0) {
+        if (fd >= 0) close(fd);
+        set_error(cat, "cannot migrate catalog to version %d", CATALOG_VERSION);
+        return false;
+    }
+    close(cat->fd);
+    cat->fd = fd;
+    cat->header = header;
+    return true;
+}
+
+/* Lee y valida la cabecera; crea un catálogo vacío o migra un formato anterior si hace falta. */
+static bool load_header(Catalog *cat) {
+    struct stat st;
+    if (fstat(cat->fd, &st) != 0) return false;
+    if (st.st_size == 0 && !cat->readonly) {
+        header_init(&cat->header, 0, (uint64_t)time(NULL));
+        return write_header(cat);
+    }
+    bool migrated = false;
+    if (st.st_size < (off_t)sizeof(CatalogHeader) ||
+        pread(cat->fd, &cat->header, sizeof(cat->header), 0) != (ssize_t)sizeof(cat->header) ||
+        memcmp(cat->header.magic, CATALOG_MAGIC, sizeof(cat->header.magic)) != 0) {
+        // Fichero antiguo: volcado de Product sin cabecera.
+        if (st.st_size % sizeof(ProductV1) != 0) {
+            set_error(cat, "unrecognised catalog format");
+            return false;
+        }
+        if (!migrate_full_records(cat, 0, (uint64_t)st.st_size / sizeof(ProductV1)))
+            return false;
+        migrated = true;
+    } else if (cat->header.version == 1) {
+        if (cat->header.record_size != sizeof(ProductV1)) {
+            set_error(cat, "version 1 record size %u does not match (%zu)",
+                      cat->header.record_size, sizeof(ProductV1));
+            return false;
+        }
+        if (!migrate_full_records(cat, cat->header.header_size, cat->header.record_count))
+            return false;
+        migrated = true;
+    } else if (cat->header.version == 2) {
+        if (!migrate_v2(cat))
+            return false;
+        migrated = true;
+    } else if (cat->header.version == 3) {
+        if (!migrate_v3(cat, st.st_size))
+            return false;
+        migrated = true;
+    }
+    if (cat->header.version != CATALOG_VERSION) {
+        set_error(cat, "unsupported catalog version %u", cat->header.version);
+        return false;
+    }
+    if (cat->header.record_size != sizeof(HotProduct) || cat->header.header_size < sizeof(CatalogHeader)) {
+        set_error(cat, "record size %u does not match this program (%zu)",
+                  cat->header.record_size, sizeof(HotProduct));
+        return false;
+    }
+    cat->data_offset = cat->header.header_size;
+    if (migrated && fstat(cat->fd, &st) != 0)
+        return false;
+    // Un fichero truncado conserva los registros que caben completos.
+    uint64_t fits = ((uint64_t)st.st_size - cat->data_offset) / sizeof(HotProduct);
+    if (cat->header.record_count > fits) {
+        cat->header.record_count = fits;
+        cat->header.index_offset = 0;
+    }
+    return true;
+}
+
+/* Guarda los índices tras los registros para que la próxima apertura sea inmediata. */
+static bool save_index(Catalog *cat) {
+    if (cat->readonly || cat->header.index_offset != 0 || cat->capacity == 0)
+        return true;
+    off_t offset = record_offset(cat, cat->count);
+    offset = (offset + 7) & ~(off_t)7;
+    size_t size = index_section_size(cat->capacity);
+    if (!write_index(cat->fd, offset, cat) || ftruncate(cat->fd, offset + (off_t)size) != 0 ||
+        fdatasync(cat->fd) != 0)
+        return false;
+    cat->header.index_offset = (uint64_t)offset;
+    cat->header.index_size = size;
+    cat->header.dead_count = cat->dead;
+    return write_header(cat) && fdatasync(cat->fd) == 0;
+}
+
+/* Carga los índices persistidos si corresponden al fichero; si no, los reconstruye. */
+static bool load_index(Catalog *cat) {
+    CatalogIndexHeader ih;
+    off_t offset = (off_t)cat->header.index_offset;
+    if (offset != 0 &&
+        pread(cat->fd, &ih, sizeof(ih), offset) == (ssize_t)sizeof(ih) &&
+        ih.hash_version == CATALOG_HASH_VERSION &&
+        ih.capacity >= CATALOG_MIN_CAPACITY && (ih.capacity & (ih.capacity - 1)) == 0 &&
+        index_section_size(ih.capacity) == cat->header.index_size &&
+        ih.used <= cat->count && ih.capacity >= cat->count) {
+        size_t slots_size = ih.capacity * sizeof(uint32_t);
+        size_t ean_size = ih.capacity * sizeof(EanSlot);
+        uint32_t *slots = malloc(slots_size);
+        EanSlot *ean_slots = malloc(ean_size);
+        if (slots && ean_slots &&
+            pread(cat->fd, slots, slots_size, offset + (off_t)sizeof(ih)) == (ssize_t)slots_size &&
+            pread(cat->fd, ean_slots, ean_size, offset + (off_t)(sizeof(ih) + slots_size)) == (ssize_t)ean_size &&
+            index_in_bounds(slots, ean_slots, ih.capacity, cat->count)) {
+            free(cat->slots);
+            free(cat->ean_slots);
+            cat->slots = slots;
+            cat->ean_slots = ean_slots;
+            cat->capacity = ih.capacity;
+            cat->used = ih.used;
+            cat->ean_used = ih.ean_used;
+            cat->dead = cat->header.dead_count;
+            return true;
+        }
+        free(slots);
+        free(ean_slots);
+    }
+    if (!index_build(cat, cat->count)) return false;
+    if (cat->readonly) return true;
+    cat->header.index_offset = 0;
+    cat->header.index_size = 0;
+    cat->header.dead_count = cat->dead;
+    return write_header(cat);
+}
+
+static bool open_file(Catalog *cat) {
+    int fd = open(cat->filename, cat->readonly ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        set_error(cat, "cannot open file");
+        return false;
+    }
+    unmap(cat);
+    if (cat->fd >= 0)
+        close(cat->fd);
+    if (cat->cold_fd >= 0)
+        close(cat->cold_fd);
+    if (cat->dict_fd >= 0)
+        close(cat->dict_fd);
+    cat->fd = fd;
+    cat->cold_fd = -1;
+    cat->dict_fd = -1;
+    if (!load_header(cat)) return false;
+    // Una migración en solo lectura ya deja abiertos sus temporales.
+    if (cat->cold_fd < 0 && !open_companions(cat)) return false;
+    if (!remap(cat)) {
+        set_error(cat, "cannot map file");
+        return false;
+    }
+    return load_index(cat);
+}
+
+// ---------------------------------------------------------------------------
+// Compactación en segundo plano
+// ---------------------------------------------------------------------------
+/* Copia los registros vivos de [from, to) y sus entradas frías. Requiere el cerrojo. */
+static bool copy_live(Catalog *cat, CatalogWriter *w, size_t from, size_t to) {
+    for (size_t pos = from; pos < to; pos++) {
+        if (HOT_IS_DELETED(&cat->hot[pos]))
+            continue;
+        HotProduct hot = cat->hot[pos];
+        size_t size = cold_entry_size(cat->cold, cat->cold_size, hot.cold_offset);
+        if (!writer_add_entry(w, &hot, cat->cold + (size ? hot.cold_offset : 0), size))
+            return false;
+    }
+    return true;
+}
+
+/*
+  Pone al día en la copia las existencias de los registros de [0, to) ya
+  copiados, que catalog_apply_stock() ha podido cambiar entretanto. Los
+  registros vivos se copian en orden: el k-ésimo vivo es el registro k de la
+  copia. Requiere el cerrojo.
+*/
+static bool copy_stock(Catalog *cat, CatalogWriter *w, size_t to) {
+    if (fflush(w->hot) != 0)
+        return false;
+    if (w->header.record_count == 0)
+        return true;
+    size_t size = sizeof(CatalogHeader) + (size_t)w->header.record_count * sizeof(HotProduct);
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(w->hot), 0);
+    if (map == MAP_FAILED)
+        return false;
+    HotProduct *copy = (HotProduct *)((char *)map + sizeof(CatalogHeader));
+    size_t k = 0;
+    for (size_t pos = 0; pos < to; pos++) {
+        const HotProduct *hot = &cat->hot[pos];
+        if (HOT_IS_DELETED(hot))
+            continue;
+        if (copy[k].stock != hot->stock || copy[k].stock_ticket != hot->stock_ticket) {
+            copy[k].stock = hot->stock;
+            copy[k].stock_ticket = hot->stock_ticket;
+        }
+        k++;
+    }
+    return munmap(map, size) == 0;
+}
+
+/* Copia los diccionarios conservando los códigos. Requiere el cerrojo. */
+static bool copy_dict(Catalog *cat, CatalogWriter *w) {
+    for (int c = 0; c < CATALOG_DICT_COLUMNS; c++) {
+        for (uint32_t i = 0; i < cat->dict[c].count; i++) {
+            const char *value = cat->dict[c].values[i];
+            if (dict_push(&w->dict[c], value, strlen(value)) < 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+/*
+  La reapertura tras instalar la compactación falló: sin proyección ni
+  índice, las búsquedas no encuentran nada y las escrituras se rechazan.
+  Requiere el cerrojo.
+*/
+static void fail_catalog(Catalog *cat) {
+    unmap(cat);
+    free(cat->slots);
+    free(cat->ean_slots);
+    cat->slots = NULL;
+    cat->ean_slots = NULL;
+    cat->capacity = 0;
+    cat->used = 0;
+    cat->ean_used = 0;
+    cat->failed = true;
+}
+
+/*
+  Una pasada de compactación. La copia se hace por tramos soltando el cerrojo
+  entre ellos, de modo que las ventas siguen buscando productos mientras
+  tanto. Solo el paso final (altas llegadas durante la copia, diccionario,
+  rename y reconstrucción del índice) se hace con el cerrojo tomado. Las
+  existencias descontadas durante la copia se ponen al día en ese paso; si
+  entretanto se ha modificado o borrado algún registro, la pasada se
+  descarta.
+*/
+static bool compact_once(Catalog *cat, bool *retry) {
+    *retry = false;
+    char *hot_tmp = suffixed_name(cat->filename, ".tmp");
+    char *cold_tmp = suffixed_name(cat->cold_filename, ".tmp");
+    char *dict_tmp = suffixed_name(cat->dict_filename, ".tmp");
+    CatalogWriter w;
+
+    pthread_mutex_lock(&cat->lock);
+    unsigned long generation = cat->generation;
+    size_t total = cat->count;
+    uint64_t cold_id = cat->header.cold_id + 1;
+    pthread_mutex_unlock(&cat->lock);
+
+    bool ok = hot_tmp && cold_tmp && dict_tmp && writer_open(&w, hot_tmp, cold_tmp, cold_id);
+    if (!ok) {
+        free(hot_tmp);
+        free(cold_tmp);
+        free(dict_tmp);
+        return false;
+    }
+    for (size_t from = 0; from < total && ok; from += COMPACT_CHUNK) {
+        size_t to = from + COMPACT_CHUNK < total ? from + COMPACT_CHUNK : total;
+        pthread_mutex_lock(&cat->lock);
+        ok = cat->generation == generation && copy_live(cat, &w, from, to);
+        pthread_mutex_unlock(&cat->lock);
+    }
+
+    pthread_mutex_lock(&cat->lock);
+    if (ok && cat->generation != generation) {
+        ok = false;
+        *retry = true;
+    }
+    if (ok) ok = copy_stock(cat, &w, total) && copy_live(cat, &w, total, cat->count) &&
+                 copy_dict(cat, &w);
+    if (ok) ok = writer_finish(&w, dict_tmp, false);
+    else writer_abort(&w);
+    bool installed = false;
+    if (ok) ok = install_files(cat, hot_tmp, cold_tmp, dict_tmp, &installed);
+    // Con el caliente ya en su sitio, open_file() recupera los temporales que falten.
+    if (installed && !open_file(cat)) {
+        fail_catalog(cat);
+        ok = false;
+    }
+    pthread_mutex_unlock(&cat->lock);
+
+    if (!ok && !installed) {
+        remove(hot_tmp);
+        remove(cold_tmp);
+        remove(dict_tmp);
+    }
+    free(hot_tmp);
+    free(cold_tmp);
+    free(dict_tmp);
+    return ok;
+}
+
+static void *compact_thread(void *arg) {
+    Catalog *cat = arg;
+    bool retry = true;
+    for (int attempt = 0; attempt < COMPACT_RETRIES && retry; attempt++)
+        compact_once(cat, &retry);
+    pthread_mutex_lock(&cat->lock);
+    cat->compacting = false;
+    pthread_mutex_unlock(&cat->lock);
+    return NULL;
+}
+
+/* Lanza la compactación si hay suficientes lápidas. Requiere el cerrojo. */
+static void maybe_compact(Catalog *cat) {
+    if (cat->readonly || cat->failed || cat->compacting || cat->dead < COMPACT_MIN_DEAD ||
+        (double)cat->dead < (double)cat->count * cat->compact_ratio)
+        return;
+    if (cat->compactor_started) {
+        pthread_join(cat->compactor, NULL);
+        cat->compactor_started = false;
+    }
+    if (pthread_create(&cat->compactor, NULL, compact_thread, cat) == 0) {
+        cat->compacting = true;
+        cat->compactor_started = true;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// API pública
+// ---------------------------------------------------------------------------
+static bool open_catalog(Catalog *cat, const char *filename, bool readonly) {
+    memset(cat, 0, sizeof(*cat));
+    pthread_mutex_init(&cat->lock, NULL);
+    cat->compact_ratio = CATALOG_DEFAULT_COMPACT_RATIO;
+    cat->readonly = readonly;
+    cat->fd = -1;
+    cat->cold_fd = -1;
+    cat->dict_fd = -1;
+    cat->filename = strdup(filename);
+    cat->cold_filename = companion_name(filename, ".cold");
+    cat->dict_filename = companion_name(filename, ".dict");
+    if (!cat->filename || !cat->cold_filename || !cat->dict_filename || !open_file(cat)) {
+        char error[sizeof(cat->error)];
+        memcpy(error, cat->error, sizeof(error));
+        catalog_close(cat);
+        memcpy(cat->error, error, sizeof(error));
+        return false;
+    }
+    return true;
+}
+
+bool catalog_open(Catalog *cat, const char *filename) {
+    return open_catalog(cat, filename, false);
+}
+
+/* Apertura para herramientas: no crea ni escribe nada; un formato anterior se convierte a un temporal. */
+bool catalog_open_readonly(Catalog *cat, const char *filename) {
+    return open_catalog(cat, filename, true);
+}
+
+/* Espera a que termine una compactación en curso, persiste los índices y libera el catálogo. */
+void catalog_close(Catalog *cat) {
+    if (cat->compactor_started)
+        pthread_join(cat->compactor, NULL);
+    if (cat->fd >= 0 && cat->filename)
+        save_index(cat);
+    unmap(cat);
+    if (cat->fd >= 0)
+        close(cat->fd);
+    if (cat->cold_fd >= 0)
+        close(cat->cold_fd);
+    if (cat->dict_fd >= 0)
+        close(cat->dict_fd);
+    free(cat->slots);
+    free(cat->ean_slots);
+    dict_free(cat->dict);
+    free(cat->filename);
+    free(cat->cold_filename);
+    free(cat->dict_filename);
+    pthread_mutex_destroy(&cat->lock);
+    memset(cat, 0, sizeof(*cat));
+    cat->fd = -1;
+    cat->cold_fd = -1;
+    cat->dict_fd = -1;
+}
+
+/* Vuelve a abrir los ficheros (p. ej. tras sustituirlos por rename) y reconstruye el índice. */
+bool catalog_reload(Catalog *cat) {
+    pthread_mutex_lock(&cat->lock);
+    bool ok = open_file(cat);
+    if (ok)
+        cat->failed = false;
+    else
+        fail_catalog(cat);
+    pthread_mutex_unlock(&cat->lock);
+    return ok;
+}
+
+/*
+  Empieza a escribir un catálogo nuevo registro a registro, sin tenerlo
+  entero en memoria. Nada es visible para catalog_open() hasta
+  catalog_writer_finish().
+*/
+CatalogWriter *catalog_writer_create(const char *filename) {
+    CatalogWriter *w = malloc(sizeof(*w));
+    char *cold_path = companion_name(filename, ".cold");
+    char *dict_path = companion_name(filename, ".dict");
+    bool ok = w && cold_path && dict_path && writer_open(w, filename, cold_path, (uint64_t)time(NULL));
+    free(cold_path);
+    if (!ok) {
+        free(w);
+        free(dict_path);
+        return NULL;
+    }
+    w->dict_path = dict_path;
+    return w;
+}
+
+bool catalog_writer_add(CatalogWriter *w, const Product *prod) {
+    return writer_add(w, prod);
+}
+
+uint64_t catalog_writer_count(const CatalogWriter *w) {
+    return w->header.record_count;
+}
+
+/* Escribe diccionarios, índices y cabecera, y libera el writer. */
+bool catalog_writer_finish(CatalogWriter *w) {
+    bool ok = writer_finish(w, w->dict_path, true);
+    free(w->dict_path);
+    free(w);
+    return ok;
+}
+
+void catalog_writer_abort(CatalogWriter *w) {
+    writer_abort(w);
+    free(w->dict_path);
+    free(w);
+}
+
+/* Escribe un catálogo completo (cabecera, registros, textos, diccionarios e índices) de una vez. */
+bool catalog_write_file(const char *filename, const Product *products, size_t count) {
+    CatalogWriter *w = catalog_writer_create(filename);
+    if (!w) return false;
+    for (size_t i = 0; i < count; i++) {
+        if (!catalog_writer_add(w, &products[i])) {
+            catalog_writer_abort(w);
+            return false;
+        }
+    }
+    return catalog_writer_finish(w);
+}
+
+/* Número de posiciones del fichero, incluidas las lápidas aún no compactadas. */
+/* true si el catálogo quedó inutilizable (ver error) hasta catalog_reload(). */
+bool catalog_failed(Catalog *cat) {
+    pthread_mutex_lock(&cat->lock);
+    bool failed = cat->failed;
+    pthread_mutex_unlock(&cat->lock);
+    return failed;
+}
+
+size_t catalog_count(Catalog *cat) {
+    pthread_mutex_lock(&cat->lock);
+    size_t count = cat->count;
+    pthread_mutex_unlock(&cat->lock);
+    return count;
+}
+
+/* Devuelve false si la posición no existe o contiene un registro borrado. */
+bool catalog_get(Catalog *cat, size_t pos, Product *out) {
+    pthread_mutex_lock(&cat->lock);
+    bool found = pos < cat->count && !HOT_IS_DELETED(&cat->hot[pos]);
+    if (found)
+        materialize(cat, pos, out);
+    pthread_mutex_unlock(&cat->lock);
+    return found;
+}
+
+/* Como catalog_get, pero solo copia los 64 bytes del registro caliente. */
+bool catalog_get_hot(Catalog *cat, size_t pos, HotProduct *out) {
+    pthread_mutex_lock(&cat->lock);
+    bool found = pos < cat->count && !HOT_IS_DELETED(&cat->hot[pos]);
+    if (found)
+        *out = cat->hot[pos];
+    pthread_mutex_unlock(&cat->lock);
+    return found;
+}
+
+bool catalog_find(Catalog *cat, int id, Product *out) {
+    pthread_mutex_lock(&cat->lock);
+    long pos = index_lookup(cat, id);
+    if (pos >= 0)
+        materialize(cat, (size_t)pos, out);
+    pthread_mutex_unlock(&cat->lock);
+    return pos >= 0;
+}
+
+bool catalog_find_hot(Catalog *cat, int id, HotProduct *out) {
+    pthread_mutex_lock(&cat->lock);
+    long pos = index_lookup(cat, id);
+    if (pos >= 0)
+        *out = cat->hot[pos];
+    pthread_mutex_unlock(&cat->lock);
+    return pos >= 0;
+}
+
+bool catalog_find_ean(Catalog *cat, uint64_t ean, Product *out) {
+    pthread_mutex_lock(&cat->lock);
+    long pos = ean_lookup(cat, ean);
+    if (pos >= 0)
+        materialize(cat, (size_t)pos, out);
+    pthread_mutex_unlock(&cat->lock);
+    return pos >= 0;
+}
+
+/* Código del valor en la columna (0 = cadena vacía), o -1 si ningún producto lo usa. */
+int catalog_dict_code(Catalog *cat, CatalogDictColumn column, const char *value) {
+    if (column >= CATALOG_DICT_COLUMNS) return -1;
+    pthread_mutex_lock(&cat->lock);
+    int code = dict_find(&cat->dict[column], value, strlen(value));
+    pthread_mutex_unlock(&cat->lock);
+    return code;
+}
+
+/* Copia en 'out' el texto de un código; false si el código no existe. */
+bool catalog_dict_value(Catalog *cat, CatalogDictColumn column, uint16_t code, char *out, size_t size) {
+    if (column >= CATALOG_DICT_COLUMNS || size == 0) return false;
+    pthread_mutex_lock(&cat->lock);
+    const DictColumn *col = &cat->dict[column];
+    bool found = code <= col->count;
+    if (found)
+        snprintf(out, size, "%s", code == 0 ? "" : col->values[code - 1]);
+    pthread_mutex_unlock(&cat->lock);
+    return found;
+}
+
+/* Número de valores distintos (sin contar la cadena vacía) de la columna. */
+size_t catalog_dict_count(Catalog *cat, CatalogDictColumn column) {
+    if (column >= CATALOG_DICT_COLUMNS) return 0;
+    pthread_mutex_lock(&cat->lock);
+    size_t count = cat->dict[column].count;
+    pthread_mutex_unlock(&cat->lock);
+    return count;
+}
+
+/*
+  Escribe primero los valores nuevos del diccionario, después la entrada
+  fría, el registro caliente y por último el recuento de la cabecera: un
+  corte a mitad deja como mucho texto huérfano, que la siguiente
+  compactación descarta.
+*/
+bool catalog_append(Catalog *cat, const Product *prod) {
+    HotProduct hot;
+    if (prod->ID <= 0 || cat->readonly || !hot_from_product(prod, 0, &hot)) return false;
+    char entry[COLD_ENTRY_MAX];
+    size_t size = cold_encode(prod, entry);
+    pthread_mutex_lock(&cat->lock);
+    if (cat->failed) {
+        pthread_mutex_unlock(&cat->lock);
+        return false;
+    }
+    bool ok = false;
+    hot.cold_offset = (uint32_t)cat->cold_size;
+
+    uint32_t dict_counts[CATALOG_DICT_COLUMNS];
+    char dict_entries[CATALOG_DICT_COLUMNS * (2 + 255)];
+    size_t dict_bytes = 0;
+    bool encoded = true;
+    for (int c = 0; c < CATALOG_DICT_COLUMNS; c++)
+        dict_counts[c] = cat->dict[c].count;
+    for (int c = 0; c < CATALOG_DICT_COLUMNS; c++) {
+        bool added;
+        const char *value = (const char *)prod + dict_fields[c].offset;
+        int code = dict_intern(&cat->dict[c], value, field_length(prod, &dict_fields[c]), &added);
+        if (code < 0) {
+            encoded = false;
+            break;
+        }
+        hot.dict[c] = (uint16_t)code;
+        if (added)
+            dict_bytes += dict_entry_encode(c, cat->dict[c].values[code - 1], dict_entries + dict_bytes);
+    }
+    if (encoded && (dict_bytes == 0 ||
+        pwrite(cat->dict_fd, dict_entries, dict_bytes, (off_t)cat->dict_size) == (ssize_t)dict_bytes)) {
+        cat->dict_size += dict_bytes;
+    } else {
+        // El fichero no recibió los valores nuevos: los códigos deben seguir alineados con él.
+        for (int c = 0; c < CATALOG_DICT_COLUMNS; c++)
+            dict_truncate(&cat->dict[c], dict_counts[c]);
+        encoded = false;
+    }
+
+    if (encoded && cat->cold_size + size <= UINT32_MAX && invalidate_index(cat) &&
+        pwrite(cat->cold_fd, entry, size, (off_t)cat->cold_size) == (ssize_t)size &&
+        pwrite(cat->fd, &hot, sizeof(hot), record_offset(cat, cat->count)) == (ssize_t)sizeof(hot)) {
+        cat->header.record_count = cat->count + 1;
+        if (write_header(cat) && remap(cat)) {
+            if ((cat->used + 1) * 2 > cat->capacity || (cat->ean_used + 1) * 2 > cat->capacity) {
+                ok = index_build(cat, cat->count);
+            } else {
+                index_insert(cat, cat->count - 1);
+                ok = true;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cat->lock);
+    return ok;
+}
+
+/* Marca el registro como lápida escribiendo solo su campo flags en el fichero. */
+bool catalog_remove(Catalog *cat, int id) {
+    if (cat->readonly) return false;
+    pthread_mutex_lock(&cat->lock);
+    long pos = index_lookup(cat, id);
+    bool ok = false;
+    if (pos >= 0 && invalidate_index(cat)) {
+        uint32_t flags = cat->hot[pos].flags | HOT_DELETED;
+        off_t offset = record_offset(cat, (size_t)pos) + (off_t)offsetof(HotProduct, flags);
+        index_erase(cat, (size_t)pos);
+        ok = pwrite(cat->fd, &flags, sizeof(flags), offset) == (ssize_t)sizeof(flags);
+        if (ok) {
+            cat->dead++;
+            cat->generation++;
+            cat->header.dead_count = cat->dead;
+            write_header(cat);
+            maybe_compact(cat);
+        } else {
+            index_insert(cat, (size_t)pos);
+        }
+    }
+    pthread_mutex_unlock(&cat->lock);
+    return ok;
+}
+
+/*
+  Descuenta existencias de todas las líneas de un ticket ya registrado. Cada
+  línea reescribe su registro caliente entero (una línea de caché, que no
+  cruza un sector) con el stock nuevo y el ticket en stock_ticket; las que ya
+  tienen este ticket o uno posterior se saltan, así que aplicar dos veces el
+  mismo ticket no descuenta dos veces. No espera al disco: eso lo hace
+  catalog_sync().
+*/
+bool catalog_apply_stock(Catalog *cat, uint64_t ticket_id, const StockDelta *deltas, size_t count) {
+    if (cat->readonly) return false;
+    pthread_mutex_lock(&cat->lock);
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        long pos = index_lookup(cat, deltas[i].ID);
+        if (pos < 0) {
+            ok = false; // Producto borrado después de la venta
+            continue;
+        }
+        HotProduct hot = cat->hot[pos];
+        if (hot.stock_ticket >= ticket_id)
+            continue;
+        hot.stock -= deltas[i].qty;
+        hot.stock_ticket = ticket_id;
+        if (pwrite(cat->fd, &hot, sizeof(hot), record_offset(cat, (size_t)pos)) != (ssize_t)sizeof(hot))
+            ok = false;
+    }
+    // Sin tocar generation: la compactación copia las existencias al final.
+    pthread_mutex_unlock(&cat->lock);
+    return ok;
+}
+
+/* Lleva al disco las existencias descontadas hasta ahora. */
+bool catalog_sync(Catalog *cat) {
+    if (cat->readonly) return false;
+    pthread_mutex_lock(&cat->lock);
+    // Un catálogo fallido no ha recibido las existencias: que no se apunten.
+    bool ok = !cat->failed && fdatasync(cat->fd) == 0;
+    pthread_mutex_unlock(&cat->lock);
+    return ok;
+}
+
+/* Compacta ya si el fichero abierto arrastra demasiadas lápidas. */
+void catalog_compact_if_needed(Catalog *cat) {
+    pthread_mutex_lock(&cat->lock);
+    maybe_compact(cat);
+    pthread_mutex_unlock(&cat->lock);
+}
@@ -0,0 +1,242 @@
+/*
+  Motor de catálogo de productos.
+
+  Proyecta el catálogo en memoria (mmap) una sola vez al arrancar y mantiene
+  dos índices hash de direccionamiento abierto: uno sobre el ID y otro sobre
+  el código EAN-13 empaquetado como entero de 64 bits, de modo que cada
+  búsqueda en caja (teclado o escáner) es O(1) y no hace llamadas al sistema.
+
+  Borrar un producto solo marca su registro como lápida; la compactación que
+  recupera el espacio corre en un hilo aparte, así que el catálogo protege su
+  estado con un cerrojo y entrega siempre copias de los registros.
+
+  Los precios son céntimos enteros (Money): en memoria de 64 bits y en el
+  registro caliente de 32, que sobra para un precio unitario y mantiene el
+  registro en una línea de caché.
+
+  Formato (versión 4), partido en datos calientes y fríos:
+    products.dat:  CatalogHeader (64 bytes) | record_count x HotProduct | índice opcional
+    products.cold: ColdHeader (16 bytes) | entradas de texto de longitud variable
+    products.dict: ColdHeader (16 bytes) | valores de las columnas de diccionario
+  Cada HotProduct ocupa una línea de caché con lo que usan la venta, el
+  descuento de existencias y los recorridos de precios; los textos libres
+  (nombre, descripciones) viven en el fichero frío y se leen solo al
+  reconstruir el Product completo. Fabricante, proveedor, departamento,
+  clase, subclase y tipo de IVA se guardan como códigos de diccionario, de
+  modo que agrupar o filtrar por ellos es comparar enteros.
+
+  La sección de índice guarda las dos tablas hash tal cual; se escribe al
+  cerrar el catálogo y se invalida en la cabecera ante cualquier alta o baja,
+  de modo que una apertura tras un cierre limpio no recorre los registros.
+  Los ficheros de versiones anteriores y los antiguos sin cabecera se migran al abrirlos.
+*/
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "money.h"
+
+// ---------------------------------------------------------------------------
+// Estructura del producto (vista completa de un registro)
+// ---------------------------------------------------------------------------
+typedef struct {
+    int    ID;
+    char   EAN13[14];         // Código EAN13 (13 caracteres + '\0')
+    char   product[100];
+    Money  price;             // Céntimos
+    int    stock;
+    Money  price01;
+    Money  price02;
+    Money  price03;
+    Money  price04;
+    char   fabricante[50];
+    char   proveedor[50];
+    char   departamento[50];
+    char   clase[50];
+    char   subclase[50];
+    char   tipo_IVA[20];
+    char   descripcion1[100];
+    char   descripcion2[100];
+    char   descripcion3[100];
+    char   descripcion4[100];
+} Product;
+
+// ---------------------------------------------------------------------------
+// Columnas codificadas por diccionario
+// ---------------------------------------------------------------------------
+// Columnas con pocos valores distintos en todo el catálogo: cada registro
+// guarda un código de 16 bits (0 = cadena vacía) en lugar del texto.
+typedef enum {
+    DICT_FABRICANTE,
+    DICT_PROVEEDOR,
+    DICT_DEPARTAMENTO,
+    DICT_CLASE,
+    DICT_SUBCLASE,
+    DICT_TIPO_IVA,
+    CATALOG_DICT_COLUMNS
+} CatalogDictColumn;
+
+#define CATALOG_DICT_MAX_CODE 0xFFFF
+
+// ---------------------------------------------------------------------------
+// Registro caliente de products.dat
+// ---------------------------------------------------------------------------
+typedef struct {
+    int32_t   ID;
+    int32_t   stock;
+    uint64_t  ean;            // EAN-13 empaquetado (0 = sin código válido)
+    int32_t   price;          // Céntimos, hasta CATALOG_PRICE_MAX
+    int32_t   price01;
+    int32_t   price02;
+    int32_t   price03;
+    int32_t   price04;
+    uint32_t  cold_offset;    // Entrada de textos en products.cold (0 = ninguna)
+    uint16_t  dict[CATALOG_DICT_COLUMNS]; // Códigos de products.dict, por CatalogDictColumn
+    uint32_t  flags;
+    uint64_t  stock_ticket;   // Último ticket descontado de stock (ver stock_log.h)
+} HotProduct;
+
+_Static_assert(sizeof(HotProduct) == 64, "HotProduct debe ocupar una línea de caché");
+
+#define HOT_DELETED           0x1u
+#define HOT_IS_DELETED(h)     (((h)->flags & HOT_DELETED) != 0)
+
+#define CATALOG_PRICE_MAX     INT32_MAX  // Un precio mayor no cabe en el HotProduct
+
+#define CATALOG_DEFAULT_COMPACT_RATIO 0.25
+
+// Variación de existencias de un producto (unidades vendidas en un ticket).
+// Un ticket lleva como mucho una por producto.
+typedef struct {
+    int       ID;
+    int       qty;
+} StockDelta;
+
+// ---------------------------------------------------------------------------
+// Cabeceras de los ficheros
+// ---------------------------------------------------------------------------
+#define CATALOG_MAGIC        "POSCAT\r\n"   // El \r\n delata transferencias en modo texto
+#define CATALOG_VERSION      4
+#define CATALOG_HASH_VERSION 1
+#define COLD_MAGIC           "POSCOLD\n"
+#define DICT_MAGIC           "POSDICT\n"
+
+typedef struct {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  header_size;    // Desplazamiento del primer registro
+    uint32_t  record_size;    // sizeof(HotProduct) del programa que escribió el fichero
+    uint32_t  flags;          // Reservado
+    uint64_t  record_count;   // Registros, incluidas las lápidas
+    uint64_t  dead_count;     // Lápidas
+    uint64_t  index_offset;   // Sección de índice persistida (0 = no hay)
+    uint64_t  index_size;
+    uint64_t  cold_id;        // Debe coincidir con el ColdHeader de products.cold y products.dict
+} CatalogHeader;
+
+// Cabecera común de products.cold y products.dict; solo cambia la firma.
+typedef struct {
+    char      magic[8];
+    uint64_t  cold_id;
+} ColdHeader;
+
+typedef struct {
+    uint32_t  hash_version;
+    uint32_t  reserved;
+    uint64_t  capacity;
+    uint64_t  used;
+    uint64_t  ean_used;
+    // Siguen uint32_t slots[capacity] y EanSlot ean_slots[capacity].
+} CatalogIndexHeader;
+
+// ---------------------------------------------------------------------------
+// Catálogo proyectado en memoria
+// ---------------------------------------------------------------------------
+typedef struct {
+    uint64_t  ean;            // EAN-13 empaquetado
+    uint32_t  pos;            // Posición del registro + 1 (0 = libre)
+    uint32_t  reserved;       // Relleno explícito: la tabla se persiste tal cual
+} EanSlot;
+
+typedef struct {
+    char     **values;        // values[código - 1]
+    uint32_t   count;
+    uint32_t   capacity;
+    uint16_t  *slots;         // Tabla hash de valor a código (0 = libre)
+    size_t     slot_capacity; // Potencia de dos
+} DictColumn;
+
+typedef struct {
+    char      *filename;
+    char      *cold_filename;
+    char      *dict_filename;
+    int        fd;
+    int        cold_fd;
+    int        dict_fd;
+    bool       readonly;
+    CatalogHeader header;
+    size_t     data_offset;   // header_size
+    void      *map;           // Proyección de solo lectura de cabecera y registros
+    HotProduct *hot;
+    size_t     map_size;
+    size_t     count;         // Registros completos en la proyección
+    char      *cold;          // Proyección de solo lectura de products.cold
+    size_t     cold_size;
+    DictColumn dict[CATALOG_DICT_COLUMNS];
+    size_t     dict_size;     // Bytes válidos de products.dict (punto de la siguiente alta)
+    uint32_t  *slots;         // Índice por ID: posición del registro + 1 (0 = libre)
+    size_t     capacity;      // Potencia de dos
+    size_t     used;
+    EanSlot   *ean_slots;     // Índice por EAN-13, misma capacidad que el de ID
+    size_t     ean_used;
+    size_t     dead;          // Lápidas pendientes de compactar
+    double     compact_ratio; // Proporción de lápidas que dispara la compactación
+    unsigned long generation; // Cambia con cada escritura en sitio salvo existencias
+    pthread_mutex_t lock;
+    pthread_t  compactor;
+    bool       compactor_started;
+    bool       compacting;
+    bool       failed;        // No se pudo reabrir tras compactar: sin registros
+    char       error[128];    // Motivo del último fallo de apertura (o reapertura)
+} Catalog;
+
+// Escritura secuencial de un catálogo nuevo (csv2bin, migración, compactación).
+typedef struct CatalogWriter CatalogWriter;
+
+bool ean13_pack(const char *code, uint64_t *out);
+
+bool catalog_open(Catalog *cat, const char *filename);
+bool catalog_open_readonly(Catalog *cat, const char *filename);
+bool catalog_write_file(const char *filename, const Product *products, size_t count);
+void catalog_close(Catalog *cat);
+bool catalog_reload(Catalog *cat);
+
+CatalogWriter *catalog_writer_create(const char *filename);
+bool     catalog_writer_add(CatalogWriter *w, const Product *prod);
+uint64_t catalog_writer_count(const CatalogWriter *w);
+bool     catalog_writer_finish(CatalogWriter *w);
+void     catalog_writer_abort(CatalogWriter *w);
+
+bool   catalog_failed(Catalog *cat);
+size_t catalog_count(Catalog *cat);
+bool catalog_get(Catalog *cat, size_t pos, Product *out);
+bool catalog_get_hot(Catalog *cat, size_t pos, HotProduct *out);
+bool catalog_find(Catalog *cat, int id, Product *out);
+bool catalog_find_hot(Catalog *cat, int id, HotProduct *out);
+bool catalog_find_ean(Catalog *cat, uint64_t ean, Product *out);
+
+int    catalog_dict_code(Catalog *cat, CatalogDictColumn column, const char *value);
+bool   catalog_dict_value(Catalog *cat, CatalogDictColumn column, uint16_t code, char *out, size_t size);
+size_t catalog_dict_count(Catalog *cat, CatalogDictColumn column);
+
+bool catalog_append(Catalog *cat, const Product *prod);
+bool catalog_remove(Catalog *cat, int id);
+bool catalog_apply_stock(Catalog *cat, uint64_t ticket_id, const StockDelta *deltas, size_t count);
+bool catalog_sync(Catalog *cat);
+void catalog_compact_if_needed(Catalog *cat);
+
+#endif
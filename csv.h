@@ -0,0 +1,39 @@
+/*
+  Tokenizador CSV del conversor de productos.
+
+  Parte una línea en campos sin copiarla ni modificarla: cada campo es una
+  vista (puntero y longitud) sobre la línea original, ya sin comillas de
+  apertura y cierre y sin espacios a los lados. Las comillas dobles
+  escapadas ("") se resuelven al copiar el campo a su destino, en la misma
+  pasada lineal.
+
+  La búsqueda de comas y comillas recorre la línea en bloques de 16 bytes
+  (SSE2) o de 32 (AVX2, si la CPU lo soporta).
+
+  Reglas de comillas (las de siempre del conversor):
+    - Un campo entre comillas empieza con '"' y termina en la primera '"'
+      seguida de ',', de fin de registro, de '\n' o de '\r'.
+    - Dentro de él, "" es una comilla literal; una '"' suelta se conserva.
+    - Un campo sin comillas termina en la siguiente ','.
+    - Una coma final sin nada detrás no abre un campo vacío.
+    - Un registro termina en el primer '\n' fuera de un campo entre
+      comillas, así que una descripción entre comillas puede ocupar varias
+      líneas.
+*/
+#ifndef CSV_H
+#define CSV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    const char *ptr;
+    size_t      len;
+    bool        escaped;      // Contiene "" que csv_copy() debe reducir a "
+} CsvField;
+
+int    csv_split(const char *line, size_t len, CsvField *fields, int max_fields);
+size_t csv_copy(const CsvField *field, char *dst, size_t size);
+const char *csv_record_end(const char *p, const char *end, bool at_eof);
+
+#endif
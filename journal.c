@@ -0,0 +1,963 @@
+/*
+  Diario binario de tickets: escritura en una sola llamada por ticket y
+  lectura secuencial sobre una proyección en memoria.
+
+  Un solo proceso escribe el diario, desde uno o varios hilos; al abrirlo recorre los registros y
+  recorta un final incompleto que haya dejado un corte, para que los
+  registros nuevos no queden detrás de uno roto. Solo se recorre el
+  segmento activo, y de él solo lo que sigue a la última marca: los
+  sellados ya están enteros y lo anterior a la marca ya estaba en disco.
+*/
+
+#include "journal.h"
+#include "ticket_index.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#define JOURNAL_X86 1
+#include <immintrin.h>
+#endif
+
+#ifdef __APPLE__
+#define fdatasync fsync
+#endif
+
+#define RECORD_STACK_SIZE 4096  // Los tickets normales se codifican sin malloc
+
+// ---------------------------------------------------------------------------
+// CRC-32C (Castagnoli)
+// ---------------------------------------------------------------------------
+typedef uint32_t (*Crc32cFn)(uint32_t crc, const unsigned char *p, size_t len);
+
+static uint32_t crc_table[256];
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *p, size_t len) {
+    while (len--)
+        crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef JOURNAL_X86
+/* Instrucción crc32 de SSE4.2: 8 bytes por ciclo. */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t c = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        c = _mm_crc32_u64(c, word);
+    }
+    crc = (uint32_t)c;
+    for (; len > 0; p++, len--)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+#endif
+
+static Crc32cFn crc32c_impl = crc32c_table;
+
+/* Prepara la tabla y elige la instrucción de la CPU si la hay. */
+__attribute__((constructor))
+static void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+        crc_table[i] = crc;
+    }
+#ifdef JOURNAL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_impl = crc32c_sse42;
+#endif
+}
+
+/**
+ * Acumula el CRC-32C de un bloque.
+ *
+ * @param crc  0 al empezar, o el resultado del bloque anterior
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    return ~crc32c_impl(~crc, data, len);
+}
+
+// ---------------------------------------------------------------------------
+// Codificación de registros
+// ---------------------------------------------------------------------------
+static size_t names_size(const TicketHeader *ticket, const char *const *names) {
+    size_t size = 0;
+    for (uint32_t i = 0; i < ticket->line_count; i++)
+        size += strlen(names[i]) + 1;
+    return size;
+}
+
+static inline size_t record_size(uint32_t line_count, size_t names) {
+    size_t size = sizeof(TicketHeader) + line_count * sizeof(TicketLine) + names;
+    return (size + 7) & ~(size_t)7;
+}
+
+size_t journal_record_size(const TicketHeader *ticket, const char *const *names) {
+    return record_size(ticket->line_count, names_size(ticket, names));
+}
+
+/**
+ * Codifica un ticket completo en 'buf': cabecera, líneas, nombres y relleno,
+ * con length, names_size y crc ya calculados.
+ *
+ * @param buf  Destino de journal_record_size() bytes
+ * @return     Bytes escritos
+ */
+size_t journal_encode(const TicketHeader *ticket, const TicketLine *lines,
+                      const char *const *names, void *buf) {
+    size_t names_len = names_size(ticket, names);
+    size_t size = record_size(ticket->line_count, names_len);
+    TicketHeader *header = buf;
+    *header = *ticket;
+    header->length = (uint32_t)size;
+    header->names_size = (uint32_t)names_len;
+    char *p = (char *)(header + 1);
+    if (ticket->line_count > 0)
+        memcpy(p, lines, ticket->line_count * sizeof(TicketLine));
+    p += ticket->line_count * sizeof(TicketLine);
+    for (uint32_t i = 0; i < ticket->line_count; i++) {
+        size_t len = strlen(names[i]) + 1;
+        memcpy(p, names[i], len);
+        p += len;
+    }
+    memset(p, 0, (size_t)((char *)buf + size - p));
+    header->crc = crc32c(0, (const char *)buf + 8, size - 8);
+    return size;
+}
+
+/* Devuelve el registro que empieza en 'pos' si está completo y su CRC cuadra. */
+static const TicketHeader *record_at(const char *map, size_t size, size_t pos) {
+    if (size - pos < sizeof(TicketHeader))
+        return NULL;
+    const TicketHeader *t = (const TicketHeader *)(map + pos);
+    if (t->length < sizeof(TicketHeader) || t->length % 8 != 0 ||
+        t->length > JOURNAL_MAX_RECORD || t->length > size - pos)
+        return NULL;
+    if (t->line_count > (t->length - sizeof(TicketHeader)) / sizeof(TicketLine) ||
+        record_size(t->line_count, t->names_size) != t->length)
+        return NULL;
+    if (crc32c(0, map + pos + 8, t->length - 8) != t->crc)
+        return NULL;
+    // Un nombre por línea, cada uno terminado en '\0' dentro del registro.
+    const char *name = ticket_names(t);
+    const char *end = name + t->names_size;
+    for (uint32_t i = 0; i < t->line_count; i++) {
+        const char *nul = memchr(name, '\0', (size_t)(end - name));
+        if (!nul)
+            return NULL;
+        name = nul + 1;
+    }
+    return name == end ? t : NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Escritura
+// ---------------------------------------------------------------------------
+static void set_error(char *error, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(error, 128, fmt, ap);
+    va_end(ap);
+}
+
+static bool check_header(const JournalHeader *header) {
+    return memcmp(header->magic, JOURNAL_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version == JOURNAL_VERSION &&
+           header->header_size >= sizeof(JournalHeader);
+}
+
+// ---------------------------------------------------------------------------
+// Segmentos
+// ---------------------------------------------------------------------------
+#define FOOTER_CRC_START offsetof(SegmentFooter, reserved)
+
+/* Suma un ticket al resumen del segmento. */
+static void footer_add(SegmentFooter *f, const TicketHeader *t) {
+    if (f->tickets == 0) {
+        f->first_id = t->ticket_id;
+        f->min_time = t->timestamp;
+        f->max_time = t->timestamp;
+    }
+    if (t->timestamp < f->min_time) f->min_time = t->timestamp;
+    if (t->timestamp > f->max_time) f->max_time = t->timestamp;
+    f->last_id = t->ticket_id;
+    f->agents |= ticket_index_agent_bloom(t->agent, sizeof(t->agent));
+    f->tickets++;
+}
+
+static uint32_t footer_crc(const SegmentFooter *f) {
+    return crc32c(0, (const char *)f + FOOTER_CRC_START, sizeof(*f) - FOOTER_CRC_START);
+}
+
+/* Un pie vale si su CRC cuadra y acaba justo al final del fichero. */
+static bool check_footer(const SegmentFooter *f, size_t file_size, size_t header_size) {
+    return memcmp(f->magic, JOURNAL_SEAL_MAGIC, sizeof(f->magic)) == 0 &&
+           f->crc == footer_crc(f) &&
+           f->records_end >= header_size && f->records_end == file_size - sizeof(*f);
+}
+
+static bool read_footer(int fd, size_t file_size, size_t header_size, SegmentFooter *out) {
+    return file_size >= header_size + sizeof(*out) &&
+           pread(fd, out, sizeof(*out), (off_t)(file_size - sizeof(*out))) == (ssize_t)sizeof(*out) &&
+           check_footer(out, file_size, header_size);
+}
+
+/**
+ * Nombre del segmento sellado número 'segment': "<diario>.NNNNNN".
+ *
+ * @return  Cadena con malloc, o NULL sin memoria
+ */
+char *journal_segment_name(const char *filename, uint64_t segment) {
+    size_t size = strlen(filename) + 24;
+    char *name = malloc(size);
+    if (name)
+        snprintf(name, size, "%s.%06llu", filename, (unsigned long long)segment);
+    return name;
+}
+
+/* Número de un segmento sellado a partir de su nombre, o false si no lo es. */
+static bool segment_number(const char *name, const char *base, size_t base_len, uint64_t *segment) {
+    if (strncmp(name, base, base_len) != 0 || name[base_len] != '.')
+        return false;
+    const char *digits = name + base_len + 1;
+    size_t len = strspn(digits, "0123456789");
+    if (len < 6 || digits[len] != '\0')
+        return false;
+    *segment = strtoull(digits, NULL, 10);
+    return true;
+}
+
+/* Hace duradero un rename() o un fichero nuevo en el directorio del diario. */
+static void sync_dir(const char *filename) {
+    const char *slash = strrchr(filename, '/');
+    char *dir = slash ? strndup(filename, (size_t)(slash - filename) + 1) : strdup(".");
+    int fd = dir ? open(dir, O_RDONLY | O_DIRECTORY) : -1;
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+/* Escribe la cabecera de un segmento vacío y la lleva al disco. */
+static bool write_header(int fd, uint64_t segment, int64_t *created) {
+    JournalHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = JOURNAL_VERSION;
+    header.header_size = sizeof(header);
+    header.created = (int64_t)time(NULL);
+    header.segment = segment;
+    *created = header.created;
+    return write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) && fdatasync(fd) == 0;
+}
+
+/* Sella el fichero del diario con su número, junto con su índice. */
+static bool rename_segment(const char *filename, uint64_t segment) {
+    char *sealed = journal_segment_name(filename, segment);
+    bool ok = sealed && rename(filename, sealed) == 0;
+    if (ok) {
+        // El índice es derivado: si no se puede mover, se borra y se rehace.
+        size_t len = strlen(filename);
+        char *from = malloc(len + sizeof(TICKET_INDEX_SUFFIX));
+        char *to = malloc(strlen(sealed) + sizeof(TICKET_INDEX_SUFFIX));
+        if (from && to) {
+            memcpy(from, filename, len);
+            memcpy(from + len, TICKET_INDEX_SUFFIX, sizeof(TICKET_INDEX_SUFFIX));
+            sprintf(to, "%s%s", sealed, TICKET_INDEX_SUFFIX);
+            if (rename(from, to) != 0)
+                remove(from);
+        } else if (from) {
+            remove(from);
+        }
+        free(from);
+        free(to);
+    }
+    free(sealed);
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Marcas de recuperación
+// ---------------------------------------------------------------------------
+#define MARK_CRC_START offsetof(JournalMark, summary.reserved)
+
+static uint32_t mark_crc(const JournalMark *m) {
+    return crc32c(0, (const char *)m + MARK_CRC_START, sizeof(*m) - MARK_CRC_START);
+}
+
+/* Abre "<diario>.mark". Sin él todo funciona igual, pero al abrir se recorre el segmento entero. */
+static int open_mark(const char *filename) {
+    size_t len = strlen(filename);
+    char *name = malloc(len + sizeof(JOURNAL_MARK_SUFFIX));
+    if (!name)
+        return -1;
+    memcpy(name, filename, len);
+    memcpy(name + len, JOURNAL_MARK_SUFFIX, sizeof(JOURNAL_MARK_SUFFIX));
+    int fd = open(name, O_RDWR | O_CREAT, 0644);
+    free(name);
+    return fd;
+}
+
+/* Lee la marca si su CRC cuadra, es de este segmento y no pasa del final del fichero. */
+static bool read_mark(int fd, const JournalHeader *header, size_t file_size, JournalMark *m) {
+    return fd >= 0 && pread(fd, m, sizeof(*m), 0) == (ssize_t)sizeof(*m) &&
+           memcmp(m->summary.magic, JOURNAL_MARK_MAGIC, sizeof(m->summary.magic)) == 0 &&
+           m->summary.crc == mark_crc(m) &&
+           m->segment == header->segment && m->created == header->created &&
+           m->summary.records_end >= header->header_size && m->summary.records_end <= file_size;
+}
+
+/*
+  Deja en disco que el segmento activo está entero hasta summary->records_end,
+  que ya debe estar sincronizado. Una marca rota o perdida solo alarga la
+  siguiente recuperación.
+*/
+static bool write_mark(const Journal *j, const SegmentFooter *summary) {
+    JournalMark m;
+    memset(&m, 0, sizeof(m));
+    m.summary = *summary;
+    memcpy(m.summary.magic, JOURNAL_MARK_MAGIC, sizeof(m.summary.magic));
+    m.segment = j->segment;
+    m.created = j->created;
+    m.summary.crc = mark_crc(&m);
+    return pwrite(j->mark_fd, &m, sizeof(m), 0) == (ssize_t)sizeof(m) && fdatasync(j->mark_fd) == 0;
+}
+
+/* Recorre los registros desde 'start' y devuelve dónde acaba el último válido y su ticket. */
+static bool valid_end(Journal *j, int fd, size_t file_size, size_t start, size_t *end) {
+    *end = start;
+    if (file_size <= start)
+        return true;
+    char *map = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    madvise(map + start / page * page, file_size - start / page * page, MADV_SEQUENTIAL);
+    const TicketHeader *t;
+    while ((t = record_at(map, file_size, *end)) != NULL) {
+        j->last_ticket = t->ticket_id;
+        j->has_tickets = true;
+        footer_add(&j->stats, t);
+        *end += t->length;
+    }
+    munmap(map, file_size);
+    return true;
+}
+
+/* Deshace un journal_open() a medias. */
+static bool open_failed(Journal *j, int fd) {
+    if (fd >= 0) close(fd);
+    if (j->mark_fd >= 0) close(j->mark_fd);
+    free(j->filename);
+    j->filename = NULL;
+    pthread_cond_destroy(&j->synced_cond);
+    pthread_mutex_destroy(&j->lock);
+    return false;
+}
+
+/* Marca el diario como abierto con 'size' bytes ya en disco. */
+static bool open_done(Journal *j, int fd, uint64_t size) {
+    j->fd = fd;
+    j->size = size;
+    j->synced = size;
+    return true;
+}
+
+/*
+  Sin tickets en el segmento activo, el último ticket está en el segmento
+  sellado más reciente; 'next' recibe el número que sigue al mayor.
+*/
+static void last_sealed(Journal *j, const char *filename, uint64_t *next) {
+    JournalSegments segments;
+    *next = 0;
+    if (!journal_segments_open(&segments, filename))
+        return;
+    for (size_t i = 0; i < segments.count; i++) {
+        const JournalSegment *seg = &segments.items[i];
+        if (strcmp(seg->filename, filename) == 0)
+            continue;
+        if (seg->segment >= *next)
+            *next = seg->segment + 1;
+        if (seg->sealed && seg->footer.tickets > 0) {
+            j->has_tickets = true;
+            j->last_ticket = seg->footer.last_id;
+        }
+    }
+    journal_segments_close(&segments);
+}
+
+/**
+ * Abre el diario para añadir tickets; lo crea si no existe. Si el último
+ * registro quedó a medias, lo recorta; si un corte dejó el segmento activo
+ * ya sellado, termina de renombrarlo y empieza el siguiente. Con una marca
+ * válida solo se validan los registros que la siguen.
+ *
+ * @return  false si no se puede abrir o no es un diario válido (ver j->error)
+ */
+bool journal_open(Journal *j, const char *filename) {
+    memset(j, 0, sizeof(*j));
+    j->fd = -1;
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->synced_cond, NULL);
+    j->filename = strdup(filename);
+    j->mark_fd = open_mark(filename);
+    int fd = open(filename, O_RDWR | O_CREAT | O_APPEND, 0644);
+    struct stat st;
+    if (!j->filename || fd < 0 || fstat(fd, &st) != 0) {
+        set_error(j->error, "cannot open journal");
+        return open_failed(j, fd);
+    }
+    JournalHeader header;
+    SegmentFooter footer;
+    if (st.st_size > 0 && pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+        check_header(&header) && read_footer(fd, (size_t)st.st_size, header.header_size, &footer)) {
+        close(fd);
+        fd = rename_segment(filename, header.segment) ? open(filename, O_RDWR | O_CREAT | O_APPEND, 0644) : -1;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            set_error(j->error, "cannot finish sealing journal segment");
+            return open_failed(j, fd);
+        }
+    }
+    if (st.st_size == 0) {
+        last_sealed(j, filename, &j->segment);
+        if (!write_header(fd, j->segment, &j->created)) {
+            set_error(j->error, "cannot write journal header");
+            return open_failed(j, fd);
+        }
+        sync_dir(filename);
+        return open_done(j, fd, sizeof(header));
+    }
+    size_t end;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || !check_header(&header)) {
+        set_error(j->error, "not a ticket journal (version %d)", JOURNAL_VERSION);
+        return open_failed(j, fd);
+    }
+    j->segment = header.segment;
+    j->created = header.created;
+    // Lo que cubre la marca ya estaba en disco: su resumen sustituye al recorrido.
+    size_t start = header.header_size;
+    JournalMark mark;
+    if (read_mark(j->mark_fd, &header, (size_t)st.st_size, &mark)) {
+        start = mark.summary.records_end;
+        j->marked = start;
+        j->stats = mark.summary;
+        memset(j->stats.magic, 0, sizeof(j->stats.magic));
+        j->stats.crc = 0;
+        j->stats.records_end = 0;
+        j->has_tickets = j->stats.tickets > 0;
+        j->last_ticket = j->stats.last_id;
+    }
+    if (!valid_end(j, fd, (size_t)st.st_size, start, &end) ||
+        (end < (size_t)st.st_size && (ftruncate(fd, (off_t)end) != 0 || fdatasync(fd) != 0))) {
+        set_error(j->error, "cannot recover journal tail");
+        return open_failed(j, fd);
+    }
+    if (!j->has_tickets) {
+        uint64_t next;
+        last_sealed(j, filename, &next);
+    }
+    return open_done(j, fd, end);
+}
+
+/**
+ * Añade un registro ya codificado con journal_encode() al final del diario,
+ * con una sola llamada a write() y sin esperar a que llegue al disco.
+ *
+ * @param end  Recibe el final del registro, para journal_sync()
+ * @return     false si no se pudo escribir entero (ver j->error)
+ */
+bool journal_write_record(Journal *j, const void *record, size_t size, uint64_t *end) {
+    pthread_mutex_lock(&j->lock);
+    bool ok = !j->failed;
+    if (!ok) {
+        set_error(j->error, "journal stopped after a failed sync");
+    } else {
+        ssize_t written = write(j->fd, record, size);
+        ok = written == (ssize_t)size;
+        if (ok) {
+            if (j->index)
+                ticket_index_add(j->index, record, j->size);
+            footer_add(&j->stats, record);
+            j->size += size;
+            *end = j->size;
+        } else if (written > 0 && ftruncate(j->fd, (off_t)j->size) != 0) {
+            // No dejar media escritura delante de los tickets siguientes.
+            set_error(j->error, "torn journal write");
+        } else {
+            set_error(j->error, "cannot write journal");
+        }
+    }
+    pthread_mutex_unlock(&j->lock);
+    return ok;
+}
+
+/**
+ * Codifica un ticket y lo añade al diario sin esperar a que llegue al disco.
+ *
+ * @param ticket  Cabecera; length, crc y names_size se calculan aquí
+ * @param lines   ticket->line_count líneas
+ * @param names   Nombre de producto de cada línea
+ * @param end     Recibe el final del registro, para journal_sync()
+ * @return        false si no se pudo escribir entero (ver j->error)
+ */
+bool journal_write(Journal *j, const TicketHeader *ticket, const TicketLine *lines,
+                   const char *const *names, uint64_t *end) {
+    size_t size = journal_record_size(ticket, names);
+    if (size > JOURNAL_MAX_RECORD) {
+        set_error(j->error, "ticket too large");
+        return false;
+    }
+    _Alignas(8) char stack[RECORD_STACK_SIZE];
+    char *buf = size <= sizeof(stack) ? stack : malloc(size);
+    if (!buf) {
+        set_error(j->error, "out of memory");
+        return false;
+    }
+    journal_encode(ticket, lines, names, buf);
+    bool ok = journal_write_record(j, buf, size, end);
+    if (buf != stack) free(buf);
+    return ok;
+}
+
+/**
+ * Espera a que el diario esté en disco hasta 'end'. Si nadie está
+ * sincronizando, este hilo hace de líder: espera sync_window_us para que se
+ * sumen las escrituras de otros hilos y hace un solo fdatasync() por todas.
+ *
+ * @return  false si falló el fdatasync(); el diario deja de aceptar tickets
+ */
+bool journal_sync(Journal *j, uint64_t end) {
+    pthread_mutex_lock(&j->lock);
+    while (j->synced < end && !j->failed) {
+        if (j->syncing) {
+            pthread_cond_wait(&j->synced_cond, &j->lock);
+            continue;
+        }
+        j->syncing = true;
+        unsigned window = j->sync_window_us;
+        pthread_mutex_unlock(&j->lock);
+        if (window > 0) {
+            struct timespec delay = { window / 1000000, (long)(window % 1000000) * 1000 };
+            nanosleep(&delay, NULL);
+        }
+        pthread_mutex_lock(&j->lock);
+        uint64_t target = j->size;
+        SegmentFooter summary = j->stats;
+        pthread_mutex_unlock(&j->lock);
+        bool ok = fdatasync(j->fd) == 0;
+        pthread_mutex_lock(&j->lock);
+        if (ok) {
+            j->synced = target;
+            j->sync_count++;
+        } else {
+            // Tras un fallo de fdatasync() no se sabe qué llegó al disco.
+            j->failed = true;
+        }
+        if (ok && j->mark_fd >= 0 && target - j->marked >= JOURNAL_MARK_BYTES) {
+            // Los que esperaban este fdatasync() siguen ya; el líder escribe la marca
+            // sin soltar 'syncing', así que el segmento no cambia mientras tanto.
+            pthread_cond_broadcast(&j->synced_cond);
+            pthread_mutex_unlock(&j->lock);
+            summary.records_end = target;
+            bool marked = write_mark(j, &summary);
+            pthread_mutex_lock(&j->lock);
+            if (marked)
+                j->marked = target;
+        }
+        j->syncing = false;
+        pthread_cond_broadcast(&j->synced_cond);
+    }
+    bool ok = j->synced >= end;
+    if (!ok)
+        set_error(j->error, "cannot sync journal to disk");
+    pthread_mutex_unlock(&j->lock);
+    return ok;
+}
+
+/* Escribe un ticket y vuelve cuando ya está en disco. */
+bool journal_append(Journal *j, const TicketHeader *ticket, const TicketLine *lines,
+                    const char *const *names) {
+    uint64_t end;
+    return journal_write(j, ticket, lines, names, &end) && journal_sync(j, end);
+}
+
+static bool same_day(int64_t a, int64_t b) {
+    time_t ta = (time_t)a, tb = (time_t)b;
+    struct tm ma, mb;
+    return localtime_r(&ta, &ma) && localtime_r(&tb, &mb) &&
+           ma.tm_year == mb.tm_year && ma.tm_yday == mb.tm_yday;
+}
+
+/* Indica si el segmento activo debe sellarse antes de escribir un ticket de 'timestamp'. */
+bool journal_rotate_due(Journal *j, int64_t timestamp) {
+    pthread_mutex_lock(&j->lock);
+    bool due = j->stats.tickets > 0 && !j->failed &&
+               ((j->segment_bytes > 0 && j->size >= j->segment_bytes) ||
+                (j->segment_daily && !same_day(j->stats.min_time, timestamp)));
+    pthread_mutex_unlock(&j->lock);
+    return due;
+}
+
+/* Cambia el índice del diario al segmento nuevo, vacío. */
+static void reopen_index(Journal *j) {
+    struct TicketIndex *idx = j->index;
+    JournalReader r;
+    ticket_index_close(idx);
+    j->index = NULL;
+    if (!journal_reader_open(&r, j->filename))
+        return;
+    if (ticket_index_open(idx, j->filename, &r, true))
+        j->index = idx;
+    else
+        ticket_index_close(idx);
+    journal_reader_close(&r);
+}
+
+/**
+ * Sella el segmento activo y empieza uno nuevo. Debe llamarse sin
+ * escrituras pendientes de journal_sync(), como hace el hilo escritor
+ * entre tandas.
+ *
+ * @return  false si no se pudo sellar (el segmento sigue activo) o no se
+ *          pudo crear el siguiente (j->failed); ver j->error
+ */
+bool journal_rotate(Journal *j) {
+    pthread_mutex_lock(&j->lock);
+    bool ok = !j->failed && !j->syncing;
+    if (!ok) {
+        set_error(j->error, j->failed ? "journal stopped after a failed sync" : "journal busy");
+    } else if (j->stats.tickets > 0) {
+        SegmentFooter footer = j->stats;
+        memcpy(footer.magic, JOURNAL_SEAL_MAGIC, sizeof(footer.magic));
+        footer.records_end = j->size;
+        footer.crc = footer_crc(&footer);
+        ok = write(j->fd, &footer, sizeof(footer)) == (ssize_t)sizeof(footer) &&
+             fdatasync(j->fd) == 0 && rename_segment(j->filename, j->segment);
+        if (!ok) {
+            // Sin sellar, el segmento sigue siendo el activo.
+            if (ftruncate(j->fd, (off_t)j->size) != 0 || fdatasync(j->fd) != 0)
+                j->failed = true;
+            set_error(j->error, "cannot seal journal segment");
+        } else {
+            int fd = open(j->filename, O_RDWR | O_CREAT | O_EXCL | O_APPEND, 0644);
+            int64_t created;
+            if (fd < 0 || !write_header(fd, j->segment + 1, &created)) {
+                if (fd >= 0) close(fd);
+                j->failed = true;
+                set_error(j->error, "cannot create journal segment");
+                ok = false;
+            } else {
+                sync_dir(j->filename);
+                close(j->fd);
+                j->fd = fd;
+                j->segment++;
+                j->created = created;
+                j->size = sizeof(JournalHeader);
+                j->synced = j->size;
+                j->marked = j->size;
+                j->has_tickets = true;
+                j->last_ticket = footer.last_id;
+                memset(&j->stats, 0, sizeof(j->stats));
+                if (j->index)
+                    reopen_index(j);
+            }
+        }
+    }
+    pthread_mutex_unlock(&j->lock);
+    return ok;
+}
+
+void journal_close(Journal *j) {
+    // Al cerrar con todo en disco, la marca lo cubre todo y al abrir no hay nada que recorrer.
+    if (j->fd >= 0 && j->mark_fd >= 0 && !j->failed && j->synced == j->size && j->synced > j->marked) {
+        SegmentFooter summary = j->stats;
+        summary.records_end = j->synced;
+        write_mark(j, &summary);
+    }
+    if (j->mark_fd >= 0)
+        close(j->mark_fd);
+    j->mark_fd = -1;
+    if (j->fd >= 0)
+        close(j->fd);
+    free(j->filename);
+    j->filename = NULL;
+    j->fd = -1;
+    pthread_cond_destroy(&j->synced_cond);
+    pthread_mutex_destroy(&j->lock);
+}
+
+// ---------------------------------------------------------------------------
+// Lectura
+// ---------------------------------------------------------------------------
+/**
+ * Proyecta el diario para recorrerlo con journal_next(). Un diario vacío o
+ * inexistente se lee como si no tuviera tickets.
+ *
+ * @return  false si existe pero no es un diario válido (ver r->error)
+ */
+bool journal_reader_open(JournalReader *r, const char *filename) {
+    memset(r, 0, sizeof(*r));
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return true;
+    bool ok = journal_reader_open_fd(r, fd);
+    close(fd);
+    return ok;
+}
+
+/**
+ * Como journal_reader_open(), sobre un descriptor abierto que sigue siendo
+ * de quien llama. Sirve para leer un segmento aunque se renombre al sellarlo.
+ */
+bool journal_reader_open_fd(JournalReader *r, int fd) {
+    memset(r, 0, sizeof(*r));
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        set_error(r->error, "cannot read journal");
+        return false;
+    }
+    if (st.st_size == 0)
+        return true;
+    void *map = (size_t)st.st_size >= sizeof(JournalHeader)
+        ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED || !check_header(map)) {
+        if (map != MAP_FAILED) munmap(map, (size_t)st.st_size);
+        set_error(r->error, "not a ticket journal (version %d)", JOURNAL_VERSION);
+        return false;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    const JournalHeader *header = map;
+    r->map = map;
+    r->map_size = (size_t)st.st_size;
+    r->size = r->map_size;
+    r->start = header->header_size;
+    r->created = header->created;
+    r->segment = header->segment;
+    r->pos = r->start;
+    if (r->size >= r->start + sizeof(SegmentFooter)) {
+        memcpy(&r->footer, r->map + r->size - sizeof(SegmentFooter), sizeof(SegmentFooter));
+        r->sealed = check_footer(&r->footer, r->size, r->start);
+        if (r->sealed)
+            r->size = r->footer.records_end;
+    }
+    return true;
+}
+
+/**
+ * Siguiente ticket, como puntero a la proyección (válido hasta cerrar el lector).
+ *
+ * @return  NULL al final; r->torn indica si se paró en un registro roto
+ */
+const TicketHeader *journal_next(JournalReader *r) {
+    if (!r->map || r->pos >= r->size)
+        return NULL;
+    const TicketHeader *t = record_at(r->map, r->size, r->pos);
+    if (!t) {
+        r->torn = true;
+        return NULL;
+    }
+    r->pos += t->length;
+    return t;
+}
+
+/* Sitúa el lector en un registro; el siguiente journal_next() lo valida. */
+void journal_seek(JournalReader *r, size_t pos) {
+    r->pos = pos;
+    r->torn = false;
+}
+
+void journal_reader_close(JournalReader *r) {
+    if (r->map)
+        munmap((void *)r->map, r->map_size);
+    r->map = NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Lista de segmentos
+// ---------------------------------------------------------------------------
+static int compare_segments(const void *a, const void *b) {
+    const JournalSegment *x = a, *y = b;
+    return x->segment < y->segment ? -1 : x->segment > y->segment;
+}
+
+/* Añade un segmento a la lista leyendo solo su cabecera y su pie. */
+static bool add_segment(JournalSegments *s, size_t *capacity, char *filename) {
+    if (s->count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 16;
+        JournalSegment *items = realloc(s->items, grown * sizeof(*items));
+        if (!items) {
+            free(filename);
+            return false;
+        }
+        s->items = items;
+        *capacity = grown;
+    }
+    JournalSegment *seg = &s->items[s->count++];
+    memset(seg, 0, sizeof(*seg));
+    seg->filename = filename;
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    JournalHeader header;
+    if (fd >= 0 && fstat(fd, &st) == 0 &&
+        pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) && check_header(&header)) {
+        seg->segment = header.segment;
+        seg->sealed = read_footer(fd, (size_t)st.st_size, header.header_size, &seg->footer);
+    }
+    if (fd >= 0) close(fd);
+    return true;
+}
+
+/**
+ * Lista los segmentos del diario: los sellados ("<diario>.NNNNNN") por
+ * número y, al final, el activo si existe.
+ *
+ * @return  false sin memoria o si no se puede leer el directorio (ver s->error)
+ */
+bool journal_segments_open(JournalSegments *s, const char *filename) {
+    memset(s, 0, sizeof(*s));
+    const char *slash = strrchr(filename, '/');
+    const char *base = slash ? slash + 1 : filename;
+    size_t base_len = strlen(base);
+    size_t dir_len = slash ? (size_t)(slash - filename) + 1 : 0;
+    char *dir = slash ? strndup(filename, dir_len) : strdup(".");
+    DIR *d = dir ? opendir(dir) : NULL;
+    free(dir);
+    if (!d) {
+        set_error(s->error, "cannot list journal segments");
+        return false;
+    }
+    size_t capacity = 0;
+    bool ok = true;
+    struct dirent *entry;
+    while (ok && (entry = readdir(d)) != NULL) {
+        uint64_t number;
+        if (!segment_number(entry->d_name, base, base_len, &number))
+            continue;
+        size_t len = strlen(entry->d_name);
+        char *path = malloc(dir_len + len + 1);
+        if (!path) {
+            ok = false;
+            break;
+        }
+        memcpy(path, filename, dir_len);
+        memcpy(path + dir_len, entry->d_name, len + 1);
+        ok = add_segment(s, &capacity, path);
+        // Un sellado sin cabecera legible se ordena por su nombre.
+        if (ok && !s->items[s->count - 1].sealed)
+            s->items[s->count - 1].segment = number;
+    }
+    closedir(d);
+    if (ok && s->count > 1)
+        qsort(s->items, s->count, sizeof(JournalSegment), compare_segments);
+    if (ok && access(filename, F_OK) == 0) {
+        char *active = strdup(filename);
+        ok = active && add_segment(s, &capacity, active);
+        if (ok)
+            s->items[s->count - 1].sealed = false;
+    }
+    if (!ok) {
+        journal_segments_close(s);
+        set_error(s->error, "out of memory");
+    }
+    return ok;
+}
+
+void journal_segments_close(JournalSegments *s) {
+    for (size_t i = 0; i < s->count; i++)
+        free(s->items[i].filename);
+    free(s->items);
+    s->items = NULL;
+    s->count = 0;
+}
+
+/* Si el segmento puede tener tickets con fecha en [from, to). */
+bool journal_segment_has_time(const JournalSegment *seg, int64_t from, int64_t to) {
+    return !seg->sealed || (seg->footer.tickets > 0 && seg->footer.max_time >= from && seg->footer.min_time < to);
+}
+
+bool journal_segment_has_ticket(const JournalSegment *seg, uint64_t ticket_id) {
+    return !seg->sealed || (seg->footer.tickets > 0 && seg->footer.first_id <= ticket_id &&
+                            ticket_id <= seg->footer.last_id);
+}
+
+bool journal_segment_has_agent(const JournalSegment *seg, const char *agent, size_t len) {
+    uint64_t bloom = ticket_index_agent_bloom(agent, len);
+    return !seg->sealed || (seg->footer.agents & bloom) == bloom;
+}
+
+// ---------------------------------------------------------------------------
+// Texto legible
+// ---------------------------------------------------------------------------
+/* "Ticket 12, Agent: A01, Date: 2024-12-31 00:46:00, Total: 25.99" */
+size_t ticket_header_text(const TicketHeader *t, char *buf, size_t size) {
+    char total[MONEY_BUFSIZE];
+    char datetime[20] = "";
+    time_t when = (time_t)t->timestamp;
+    struct tm tm;
+    if (localtime_r(&when, &tm))
+        strftime(datetime, sizeof(datetime), "%Y-%m-%d %H:%M:%S", &tm);
+    money_format(t->total, total);
+    int n = snprintf(buf, size, "Ticket %llu, Agent: %.*s, Date: %s, Total: %s",
+                     (unsigned long long)t->ticket_id,
+                     (int)strnlen(t->agent, sizeof(t->agent)), t->agent, datetime, total);
+    return n < 0 ? 0 : (size_t)n;
+}
+
+/* "  Wireless Mouse, 2 x 25.99" */
+size_t ticket_line_text(const TicketLine *line, const char *name, char *buf, size_t size) {
+    char price[MONEY_BUFSIZE];
+    money_format(line->unit_price, price);
+    int n = snprintf(buf, size, "  %s, %d x %s", name, line->qty, price);
+    return n < 0 ? 0 : (size_t)n;
+}
+
+/**
+ * Interpreta una fecha "AAAA-MM-DD" o "AAAA-MM-DD HH:MM[:SS]" en hora local
+ * como el intervalo que abarca: un día entero, un minuto o un segundo.
+ *
+ * @param from  Recibe el primer segundo del intervalo
+ * @param to    Recibe el primer segundo después del intervalo
+ * @return      false si el texto no es una fecha
+ */
+bool ticket_time_parse(const char *text, int64_t *from, int64_t *to) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int n = 0;
+    int fields = sscanf(text, "%d-%d-%d%n %d:%d%n:%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &n,
+                        &tm.tm_hour, &tm.tm_min, &n, &tm.tm_sec, &n);
+    if (fields < 3 || fields == 4 || text[n] != '\0' ||
+        tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31)
+        return false;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    struct tm next = tm;
+    if (fields == 3)
+        next.tm_mday++;
+    else if (fields == 5)
+        next.tm_min++;
+    else
+        next.tm_sec++;
+    time_t start = mktime(&tm);
+    time_t stop = mktime(&next);
+    if (start == (time_t)-1 || stop == (time_t)-1)
+        return false;
+    *from = (int64_t)start;
+    *to = (int64_t)stop;
+    return true;
+}
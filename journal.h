@@ -0,0 +1,222 @@
+/*
+  Diario de tickets.
+
+  Sustituye a transactions.csv: un fichero binario en el que solo se añade
+  al final, con un registro por ticket. Cada registro empieza por su
+  longitud y un CRC-32C del resto, lleva la cabecera del ticket y sus
+  líneas, y se escribe con una sola llamada a write(), así que un corte
+  deja como mucho un registro incompleto al final que los lectores
+  descartan.
+
+  Formato (versión 1):
+    JournalHeader (32 bytes) | registros
+    registro: TicketHeader | line_count x TicketLine | nombres | relleno
+  Los nombres de producto van seguidos, terminados en '\0', en el orden de
+  las líneas; el registro se rellena con ceros hasta un múltiplo de 8 bytes.
+
+  Un ticket solo se da por registrado cuando está en disco. Para no pagar un
+  fdatasync() por venta, las escrituras que llegan mientras se espera se
+  confirman juntas (group commit): el primero que espera hace de líder,
+  aguarda sync_window_us para que se le unan otros y sincroniza por todos.
+
+  La lectura proyecta el fichero en memoria y recorre los registros sin
+  copiarlos, validando cada CRC; el texto legible se obtiene con
+  "ticket_tool export".
+
+  El diario se parte en segmentos. Solo se escribe en el activo (el fichero
+  del diario); al pasar de segment_bytes o cambiar de día, journal_rotate()
+  lo sella: le añade un pie (SegmentFooter) con su primer y último ticket,
+  sus fechas y los agentes, y lo renombra a "<diario>.NNNNNN" con su número.
+  Los segmentos sellados ya no cambian, y quien busca un ticket o unas
+  fechas lee solo sus pies para saltarse los que no le sirven.
+    segmento sellado: JournalHeader | registros | SegmentFooter (72 bytes)
+
+  Cada JOURNAL_MARK_BYTES sincronizados se guarda en "<diario>.mark" hasta
+  dónde está en disco el segmento activo y su resumen hasta ahí
+  (JournalMark). Al abrir tras un corte solo se validan los registros
+  posteriores a la marca, no el segmento entero; sin marca válida se
+  recorre todo, como antes.
+*/
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "money.h"
+
+#define JOURNAL_MAGIC      "POSJRNL\n"
+#define JOURNAL_VERSION    1
+#define JOURNAL_AGENT_SIZE 20
+#define JOURNAL_MAX_RECORD (16u * 1024 * 1024)  // Tope de cordura al leer la longitud
+#define JOURNAL_SEAL_MAGIC "POSSEAL\n"
+#define JOURNAL_MARK_MAGIC "POSMARK\n"
+#define JOURNAL_MARK_SUFFIX ".mark"
+#define JOURNAL_MARK_BYTES (1u << 20)  // Sincronizados entre dos marcas
+
+typedef struct {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  header_size;    // Desplazamiento del primer registro
+    int64_t   created;        // Segundos desde 1970
+    uint64_t  segment;        // Número de segmento (0 en diarios anteriores a los segmentos)
+} JournalHeader;
+
+// Medios de pago
+#define PAYMENT_CASH 0
+
+typedef struct {
+    uint32_t  length;         // Bytes del registro, cabecera incluida (múltiplo de 8)
+    uint32_t  crc;            // CRC-32C de los length - 8 bytes que siguen
+    uint64_t  ticket_id;
+    int64_t   timestamp;      // Segundos desde 1970
+    Money     total;          // Céntimos
+    Money     paid;
+    char      agent[JOURNAL_AGENT_SIZE];
+    uint32_t  line_count;
+    uint32_t  names_size;     // Bytes de nombres tras las líneas, '\0' incluidos
+    uint16_t  payment;        // PAYMENT_*
+    uint16_t  flags;          // Reservado
+} TicketHeader;
+
+typedef struct {
+    int32_t   ID;
+    int32_t   qty;
+    Money     unit_price;     // Céntimos
+    uint32_t  reserved[2];
+} TicketLine;
+
+typedef struct {
+    char      magic[8];       // JOURNAL_SEAL_MAGIC
+    uint32_t  crc;            // CRC-32C de lo que sigue
+    uint32_t  reserved;
+    uint64_t  records_end;    // Final del último registro (donde empieza el pie)
+    uint64_t  tickets;
+    uint64_t  first_id;
+    uint64_t  last_id;
+    int64_t   min_time;
+    int64_t   max_time;
+    uint64_t  agents;         // Filtro de Bloom de los agentes (ticket_index_agent_bloom)
+} SegmentFooter;
+
+typedef struct {
+    SegmentFooter summary;    // Con JOURNAL_MARK_MAGIC; records_end = bytes ya en disco
+    uint64_t  segment;        // Segmento y fecha de creación a los que se refiere
+    int64_t   created;
+} JournalMark;
+
+_Static_assert(sizeof(TicketHeader) == 72, "TicketHeader forma parte del formato");
+_Static_assert(sizeof(TicketLine) == 24, "TicketLine forma parte del formato");
+_Static_assert(sizeof(SegmentFooter) == 72, "SegmentFooter forma parte del formato");
+_Static_assert(sizeof(JournalMark) == 88, "JournalMark forma parte del formato");
+
+// ---------------------------------------------------------------------------
+// Escritura
+// ---------------------------------------------------------------------------
+#define JOURNAL_MAX_SYNC_WINDOW 1000000  // Microsegundos
+
+struct TicketIndex;
+
+typedef struct {
+    char           *filename;
+    int             fd;
+    pthread_mutex_t lock;           // Protege todo lo que sigue
+    pthread_cond_t  synced_cond;    // Señala el fin de cada fdatasync()
+    uint64_t        size;           // Final del último registro escrito
+    uint64_t        synced;         // Bytes que ya están en disco
+    bool            syncing;        // Hay un líder sincronizando
+    bool            failed;         // Falló un fdatasync(): no se aceptan más tickets
+    unsigned        sync_window_us; // Espera del líder antes de sincronizar
+    uint64_t        sync_count;     // fdatasync() hechos
+    bool            has_tickets;    // El diario tenía tickets al abrirlo
+    uint64_t        last_ticket;    // ID del último de ellos
+    uint64_t        segment;        // Número del segmento activo
+    int64_t         created;        // Fecha de creación del segmento activo
+    uint64_t        segment_bytes;  // Sellar al llegar a este tamaño; 0 = sin límite
+    bool            segment_daily;  // Sellar al cambiar de día
+    SegmentFooter   stats;          // Resumen del segmento activo, para su pie
+    int             mark_fd;        // "<diario>.mark", o -1
+    uint64_t        marked;         // Hasta dónde cubre la última marca
+    struct TicketIndex *index;      // Opcional; se actualiza con cada ticket escrito
+    char            error[128];     // Motivo del último fallo
+} Journal;
+
+bool journal_open(Journal *j, const char *filename);
+bool journal_write_record(Journal *j, const void *record, size_t size, uint64_t *end);
+bool journal_write(Journal *j, const TicketHeader *ticket, const TicketLine *lines,
+                   const char *const *names, uint64_t *end);
+bool journal_sync(Journal *j, uint64_t end);
+bool journal_append(Journal *j, const TicketHeader *ticket, const TicketLine *lines,
+                    const char *const *names);
+bool journal_rotate_due(Journal *j, int64_t timestamp);
+bool journal_rotate(Journal *j);
+void journal_close(Journal *j);
+
+size_t journal_record_size(const TicketHeader *ticket, const char *const *names);
+size_t journal_encode(const TicketHeader *ticket, const TicketLine *lines,
+                      const char *const *names, void *buf);
+
+// ---------------------------------------------------------------------------
+// Lectura
+// ---------------------------------------------------------------------------
+typedef struct {
+    const char *map;
+    size_t     map_size;
+    size_t     size;          // Final de los registros
+    size_t     start;         // Primer registro
+    int64_t    created;       // Fecha de creación del diario
+    size_t     pos;           // Siguiente registro
+    bool       torn;          // Se paró en un registro incompleto o corrupto
+    uint64_t   segment;
+    bool       sealed;        // Tiene pie; size acaba en el último registro
+    SegmentFooter footer;
+    char       error[128];
+} JournalReader;
+
+bool journal_reader_open(JournalReader *r, const char *filename);
+bool journal_reader_open_fd(JournalReader *r, int fd);
+const TicketHeader *journal_next(JournalReader *r);
+void journal_seek(JournalReader *r, size_t pos);
+void journal_reader_close(JournalReader *r);
+
+// Segmentos del diario, para leer solo los que pueden interesar.
+typedef struct {
+    char          *filename;
+    uint64_t       segment;
+    bool           sealed;        // Sin pie (el activo) no se sabe qué contiene
+    SegmentFooter  footer;
+} JournalSegment;
+
+typedef struct {
+    JournalSegment *items;        // Sellados en orden y el activo al final
+    size_t          count;
+    char            error[128];
+} JournalSegments;
+
+bool journal_segments_open(JournalSegments *s, const char *filename);
+void journal_segments_close(JournalSegments *s);
+char *journal_segment_name(const char *filename, uint64_t segment);
+bool journal_segment_has_time(const JournalSegment *seg, int64_t from, int64_t to);
+bool journal_segment_has_ticket(const JournalSegment *seg, uint64_t ticket_id);
+bool journal_segment_has_agent(const JournalSegment *seg, const char *agent, size_t len);
+
+static inline const TicketLine *ticket_lines(const TicketHeader *t) {
+    return (const TicketLine *)(t + 1);
+}
+
+static inline const char *ticket_names(const TicketHeader *t) {
+    return (const char *)(ticket_lines(t) + t->line_count);
+}
+
+// Texto legible de un ticket: una línea de cabecera y una por producto.
+#define TICKET_TEXT_SIZE 256
+
+size_t ticket_header_text(const TicketHeader *t, char *buf, size_t size);
+size_t ticket_line_text(const TicketLine *line, const char *name, char *buf, size_t size);
+bool ticket_time_parse(const char *text, int64_t *from, int64_t *to);
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,164 @@
+/*
+  Banco de pruebas del group commit del diario de tickets.
+
+    journal_bench <fichero> [terminales] [tickets] [ventana_us ...]
+
+  Cada terminal es un hilo que registra 'tickets' ventas de tres líneas con
+  journal_append(), que no vuelve hasta que la venta está en disco. Para
+  cada ventana de espera se mide el rendimiento, los fdatasync() hechos y
+  la latencia media de una venta. La primera fila, sin fdatasync(), es el
+  techo de lo que da write() solo.
+*/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+#define MAX_TERMINALS 256
+#define NO_SYNC       -1      // Ventana de la fila de referencia
+
+static const long default_windows[] = { NO_SYNC, 0, 100, 500, 1000, 2000, 5000 };
+
+typedef struct {
+    Journal *journal;
+    long     tickets;
+    bool     sync;
+    double   latency;         // Suma de segundos por venta
+    bool     failed;
+} Terminal;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *run_terminal(void *arg) {
+    Terminal *term = arg;
+    TicketLine lines[3];
+    const char *names[3] = { "Wireless Mouse", "Mechanical Keyboard", "USB-C Cable" };
+    memset(lines, 0, sizeof(lines));
+    for (int i = 0; i < 3; i++) {
+        lines[i].ID = 1001 + i;
+        lines[i].qty = i + 1;
+        lines[i].unit_price = 2599 + 1000 * i;
+    }
+    TicketHeader ticket;
+    memset(&ticket, 0, sizeof(ticket));
+    strcpy(ticket.agent, "BENCH");
+    ticket.line_count = 3;
+    ticket.total = 2599 + 2 * 3599 + 3 * 4599;
+    ticket.paid = ticket.total;
+
+    for (long n = 0; n < term->tickets && !term->failed; n++) {
+        ticket.ticket_id = (uint64_t)n;
+        ticket.timestamp = (int64_t)time(NULL);
+        double start = now_seconds();
+        uint64_t end;
+        if (term->sync)
+            term->failed = !journal_append(term->journal, &ticket, lines, names);
+        else
+            term->failed = !journal_write(term->journal, &ticket, lines, names, &end);
+        term->latency += now_seconds() - start;
+    }
+    return NULL;
+}
+
+/* Borra el diario de prueba y su marca. */
+static void remove_journal(const char *filename) {
+    char mark[1024];
+    unlink(filename);
+    snprintf(mark, sizeof(mark), "%s%s", filename, JOURNAL_MARK_SUFFIX);
+    unlink(mark);
+}
+
+/**
+ * Registra terminals x tickets ventas en un diario nuevo y muestra una fila
+ * de resultados.
+ *
+ * @param window  Ventana en microsegundos, o NO_SYNC para no sincronizar
+ * @return        false si falló el diario
+ */
+static bool bench_window(const char *filename, int terminals, long tickets, long window) {
+    remove_journal(filename);
+    Journal journal;
+    if (!journal_open(&journal, filename)) {
+        fprintf(stderr, "No se puede abrir '%s': %s\n", filename, journal.error);
+        return false;
+    }
+    journal.sync_window_us = window > 0 ? (unsigned)window : 0;
+
+    Terminal term[MAX_TERMINALS];
+    pthread_t threads[MAX_TERMINALS];
+    double start = now_seconds();
+    for (int i = 0; i < terminals; i++) {
+        term[i] = (Terminal){ &journal, tickets, window != NO_SYNC, 0.0, false };
+        pthread_create(&threads[i], NULL, run_terminal, &term[i]);
+    }
+    double latency = 0.0;
+    bool failed = false;
+    for (int i = 0; i < terminals; i++) {
+        pthread_join(threads[i], NULL);
+        latency += term[i].latency;
+        failed |= term[i].failed;
+    }
+    double seconds = now_seconds() - start;
+    if (failed) {
+        fprintf(stderr, "Error en el diario: %s\n", journal.error);
+        journal_close(&journal);
+        return false;
+    }
+
+    long total = (long)terminals * tickets;
+    char label[24];
+    if (window == NO_SYNC)
+        snprintf(label, sizeof(label), "sin fdatasync");
+    else
+        snprintf(label, sizeof(label), "%ld", window);
+    printf("%-14s %12.0f %10llu %14.1f %12.3f\n", label,
+           seconds > 0 ? (double)total / seconds : 0.0,
+           (unsigned long long)journal.sync_count,
+           journal.sync_count ? (double)total / (double)journal.sync_count : 0.0,
+           latency / (double)total * 1e3);
+    journal_close(&journal);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Uso: %s <fichero> [terminales] [tickets] [ventana_us ...]\n", argv[0]);
+        return 1;
+    }
+    const char *filename = argv[1];
+    int terminals = argc > 2 ? atoi(argv[2]) : 4;
+    long tickets = argc > 3 ? atol(argv[3]) : 500;
+    if (terminals < 1 || terminals > MAX_TERMINALS || tickets < 1) {
+        fprintf(stderr, "Terminales (1-%d) o tickets inválidos.\n", MAX_TERMINALS);
+        return 1;
+    }
+
+    printf("%d terminales x %ld tickets\n", terminals, tickets);
+    printf("%-14s %12s %10s %14s %12s\n",
+           "ventana (us)", "tickets/s", "fdatasync", "tickets/sync", "latencia ms");
+    bool ok = true;
+    if (argc > 4) {
+        for (int i = 4; i < argc && ok; i++) {
+            long window = atol(argv[i]);
+            if (window < 0 || window > JOURNAL_MAX_SYNC_WINDOW) {
+                fprintf(stderr, "Ventana inválida: %s (0-%d us)\n", argv[i], JOURNAL_MAX_SYNC_WINDOW);
+                ok = false;
+            } else {
+                ok = bench_window(filename, terminals, tickets, window);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < sizeof(default_windows) / sizeof(default_windows[0]) && ok; i++)
+            ok = bench_window(filename, terminals, tickets, default_windows[i]);
+    }
+    remove_journal(filename);
+    return ok ? 0 : 1;
+}
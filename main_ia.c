@@ -8,7 +8,7 @@
     - Ventas (POS): Agregar productos al carrito, realizar cobro y registrar transacción.
     
   Compilar con:
-      gcc pos.c -o pos -lncurses -lform
+      make pos_ia
 */
 
 #include <ncurses.h>
@@ -21,41 +21,28 @@
 #include <unistd.h>
 #include <stdbool.h>
 
+#include "cart.h"
+#include "catalog.h"
+#include "journal.h"
+#include "money.h"
+#include "report.h"
+#include "stock_log.h"
+#include "ticket_index.h"
+#include "ticket_seq.h"
+#include "ticket_writer.h"
+
 // ---------------------------------------------------------------------------
 // Constantes y definiciones
 // ---------------------------------------------------------------------------
 #define PRODUCTS_FILE "products.dat"
 #define LAST_ID_FILE "last_id.txt"
-#define TRANSACTIONS_FILE "transactions.csv"
+#define JOURNAL_FILE "tickets.journal"
+#define TICKET_LEASE_FILE "ticket_lease.txt"
+#define REPORT_FILE "report.checkpoint"
+#define STOCK_FILE "stock.checkpoint"
 #define CONFIG_FILE "config.ini"
 #define AGENTS_FILE "agents.csv"
-
-#define MAX_CART 50
-
-// ---------------------------------------------------------------------------
-// Estructura del producto
-// ---------------------------------------------------------------------------
-typedef struct {
-    int    ID;
-    char   EAN13[14];         // Código EAN13 (13 caracteres + '\0')
-    char   product[100];
-    float  price;
-    int    stock;
-    float  price01;
-    float  price02;
-    float  price03;
-    float  price04;
-    char   fabricante[50];
-    char   proveedor[50];
-    char   departamento[50];
-    char   clase[50];
-    char   subclase[50];
-    char   tipo_IVA[20];
-    char   descripcion1[100];
-    char   descripcion2[100];
-    char   descripcion3[100];
-    char   descripcion4[100];
-} Product;
+#define ALERT_POLL_MS 250     // Cada cuánto se mira el escritor mientras se espera una tecla
 
 // ---------------------------------------------------------------------------
 // Variables globales de configuración y estado
@@ -64,15 +51,26 @@ bool beep_on_insert = false;
 char currency_symbol[10] = "$";
 bool hide_currency_symbol = false;
 bool currency_after_amount = false;
+double compact_ratio = CATALOG_DEFAULT_COMPACT_RATIO;
+long journal_sync_us = 0;    // Ventana de group commit del diario
+long journal_segment_mb = 64; // Tamaño de cada segmento del diario; 0 = sin límite
+bool journal_daily_segments = true;  // Un segmento por día
 
 char agent_code[20] = "Default";
 time_t agent_login_time;
 bool authenticated = false;
-int ticket_id = 0;
 
-Product *shopping_cart[MAX_CART];
-int cart_count = 0;
-float total = 0.0;
+Catalog catalog;
+Journal journal;
+TicketWriter ticket_writer;  // Escribe el diario en segundo plano
+TicketSeq ticket_seq;        // Numeración de tickets
+TicketIndex ticket_index = { .fd = -1 };  // Índice del diario, al día con cada ticket escrito
+SalesReport sales_report;    // Acumulados para los informes X y Z
+bool reports_ready = false;
+StockLog stock_log;          // Existencias de products.dat, al día con el diario
+bool stock_ready = false;
+
+Cart cart;                   // Venta en curso
 
 // ---------------------------------------------------------------------------
 // Prototipos de funciones
@@ -85,19 +83,25 @@ bool delete_product_disk(int ID);
 bool validate_agent_and_password(const char *filename, const char *code, const char *password);
 int read_last_id(const char *filename);
 void update_last_id(const char *filename, int last_id);
-void save_transaction(const char *filename, Product **cart, int count, float total);
+bool save_transaction(TicketWriter *writer, Cart *cart, Money paid);
+bool parse_amount(const char *text, Money *out);
+const char *amount_text(Money amount, char *buf);
 
 // Inicialización y limpieza de ncurses
 void init_ncurses(void);
 void cleanup_ncurses(void);
+void show_writer_alert(WINDOW *win);
+int read_key(WINDOW *win);
+bool read_line(char *buf, int size);
 
 // Menús
 int main_menu(void);
 int manage_products_menu(void);
 int manage_users_menu(void);
-int view_tickets_menu(void);
+int view_tickets_menu(char *query, int query_size, char *agent, int agent_size);
 int pos_sale_menu(void);
 int agent_login_menu(void);
+int reports_menu(void);
 
 // Gestión de productos
 void view_products(void);
@@ -112,7 +116,15 @@ void delete_user(void);
 // Login de agente
 void agent_login(void);
 
+// Tickets
+void view_tickets(const char *query, const char *agent);
+
+// Informes X y Z
+void ticket_committed(const TicketHeader *ticket, const Journal *journal, uint64_t end, void *ctx);
+void show_report(bool z);
+
 // Ventas (POS)
+void sales_unavailable(const char *reason, const char *detail);
 void pos_sale(void);
 
 // Función auxiliar para paginación en listados
@@ -138,61 +150,34 @@ void load_config(const char *filename) {
             hide_currency_symbol = true;
         else if (strncmp(trimmed, "currency_after_amount=1", 23) == 0)
             currency_after_amount = true;
+        else if (strncmp(trimmed, "compact_ratio=", 14) == 0)
+            sscanf(trimmed + 14, "%lf", &compact_ratio);
+        else if (strncmp(trimmed, "journal_sync_us=", 16) == 0)
+            sscanf(trimmed + 16, "%ld", &journal_sync_us);
+        else if (strncmp(trimmed, "journal_segment_mb=", 19) == 0)
+            sscanf(trimmed + 19, "%ld", &journal_segment_mb);
+        else if (strncmp(trimmed, "journal_daily_segments=0", 24) == 0)
+            journal_daily_segments = false;
     }
     fclose(file);
 }
 
+/* La consulta puede ser un código EAN-13 (escáner) o un ID numérico (teclado). */
 bool search_product_disk(const char *query, Product *result) {
     if (strlen(query) == 0)
         return false;
-    FILE *file = fopen(PRODUCTS_FILE, "rb");
-    if (!file) return false;
-    Product temp;
-    while (fread(&temp, sizeof(Product), 1, file) == 1) {
-        if (temp.ID == atoi(query)) {
-            *result = temp;
-            fclose(file);
-            return true;
-        }
-    }
-    fclose(file);
-    return false;
+    uint64_t ean;
+    if (ean13_pack(query, &ean))
+        return catalog_find_ean(&catalog, ean, result);
+    return catalog_find(&catalog, atoi(query), result);
 }
 
 bool add_product_disk(const Product *prod) {
-    FILE *file = fopen(PRODUCTS_FILE, "ab");
-    if (!file) return false;
-    size_t written = fwrite(prod, sizeof(Product), 1, file);
-    fclose(file);
-    return written == 1;
+    return catalog_append(&catalog, prod);
 }
 
 bool delete_product_disk(int ID) {
-    FILE *file = fopen(PRODUCTS_FILE, "rb");
-    if (!file) return false;
-    FILE *temp = fopen("temp.dat", "wb");
-    if (!temp) {
-        fclose(file);
-        return false;
-    }
-    Product prod;
-    bool found = false;
-    while (fread(&prod, sizeof(Product), 1, file) == 1) {
-        if (prod.ID == ID) {
-            found = true;
-            continue;
-        }
-        fwrite(&prod, sizeof(Product), 1, temp);
-    }
-    fclose(file);
-    fclose(temp);
-    if (found) {
-        remove(PRODUCTS_FILE);
-        rename("temp.dat", PRODUCTS_FILE);
-    } else {
-        remove("temp.dat");
-    }
-    return found;
+    return catalog_remove(&catalog, ID);
 }
 
 bool validate_agent_and_password(const char *filename, const char *code, const char *password) {
@@ -229,21 +214,47 @@ void update_last_id(const char *filename, int last_id) {
     fclose(file);
 }
 
-void save_transaction(const char *filename, Product **cart, int count, float total) {
-    ticket_id = read_last_id(LAST_ID_FILE);
-    FILE *file = fopen(filename, "a");
-    if (!file) return;
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    char datetime[20];
-    strftime(datetime, sizeof(datetime), "%Y-%m-%d %H:%M:%S", t);
-    fprintf(file, "Ticket %d, Agent: %s, Date: %s, Total: %.2f\n", ticket_id, agent_code, datetime, total);
-    for (int i = 0; i < count; i++) {
-        fprintf(file, "  %s, %.2f\n", cart[i]->product, cart[i]->price);
+/* Un texto en blanco vale 0; cualquier otra cosa debe ser un importe. */
+bool parse_amount(const char *text, Money *out) {
+    size_t len = strlen(text);
+    size_t blank = strspn(text, " \t\r\n");
+    if (blank == len) {
+        *out = 0;
+        return true;
     }
-    fclose(file);
-    ticket_id++;
-    update_last_id(LAST_ID_FILE, ticket_id);
+    return money_parse(text, len, out);
+}
+
+/* Importe con dos decimales en 'buf' (MONEY_BUFSIZE bytes), listo para imprimir. */
+const char *amount_text(Money amount, char *buf) {
+    money_format(amount, buf);
+    return buf;
+}
+
+/* Encola la venta para el escritor del diario; no espera al disco. */
+bool save_transaction(TicketWriter *writer, Cart *cart, Money paid) {
+    TicketLine *lines = arena_alloc(&cart->arena, cart->count * sizeof(TicketLine));
+    const char **names = arena_alloc(&cart->arena, cart->count * sizeof(char *));
+    if (!lines || !names)
+        return false;
+    for (size_t i = 0; i < cart->count; i++) {
+        memset(&lines[i], 0, sizeof(lines[i]));
+        lines[i].ID = cart->lines[i].ID;
+        lines[i].qty = cart->lines[i].qty;
+        lines[i].unit_price = cart->lines[i].unit_price;
+        names[i] = cart->lines[i].name;
+    }
+    TicketHeader ticket;
+    memset(&ticket, 0, sizeof(ticket));
+    if (!ticket_seq_next(&ticket_seq, &ticket.ticket_id))
+        return false;
+    ticket.timestamp = (int64_t)time(NULL);
+    ticket.total = cart->total;
+    ticket.paid = paid;
+    snprintf(ticket.agent, sizeof(ticket.agent), "%s", agent_code);
+    ticket.line_count = (uint32_t)cart->count;
+    ticket.payment = PAYMENT_CASH;
+    return ticket_writer_submit(writer, &ticket, lines, names);
 }
 
 // ---------------------------------------------------------------------------
@@ -267,12 +278,72 @@ void cleanup_ncurses(void) {
     endwin();
 }
 
+/*
+  Si el escritor de tickets ha fallado, lo avisa en rojo en la última línea
+  y devuelve el cursor a 'win'. Los tickets de la tanda que falló ya se
+  dieron por buenos, así que hay que verlo en cuanto pasa.
+*/
+void show_writer_alert(WINDOW *win) {
+    if (!ticket_writer.failed)
+        return;
+    attron(COLOR_PAIR(4) | A_BOLD);
+    mvprintw(LINES - 1, 0, "Tickets are not being saved (%s). Restart the POS.", ticket_writer.error);
+    attroff(COLOR_PAIR(4) | A_BOLD);
+    clrtoeol();
+    refresh();
+    if (win != stdscr) {
+        touchwin(win);
+        wrefresh(win);
+    }
+}
+
+/* wgetch() que, mientras espera, sigue pendiente del escritor de tickets. */
+int read_key(WINDOW *win) {
+    int y, x, ch;
+    getyx(win, y, x);
+    wtimeout(win, ALERT_POLL_MS);
+    while ((ch = wgetch(win)) == ERR) {
+        show_writer_alert(win);
+        wmove(win, y, x);
+    }
+    wtimeout(win, -1);
+    return ch;
+}
+
+/*
+  Lee una línea con eco en la posición del cursor, como getnstr(), pero a
+  través de read_key(). ESC la cancela.
+
+  @return  false si se canceló
+*/
+bool read_line(char *buf, int size) {
+    int y, x, len = 0;
+    getyx(stdscr, y, x);
+    for (;;) {
+        int ch = read_key(stdscr);
+        if (ch == '\n' || ch == '\r' || ch == KEY_ENTER)
+            break;
+        if (ch == 27) {
+            buf[0] = '\0';
+            return false;
+        }
+        if (ch == KEY_BACKSPACE || ch == 127 || ch == '\b') {
+            if (len > 0) { len--; mvaddch(y, x + len, ' '); move(y, x + len); }
+        } else if (isprint(ch) && len < size - 1) {
+            buf[len] = (char)ch;
+            mvaddch(y, x + len++, ch);
+        }
+    }
+    buf[len] = '\0';
+    return true;
+}
+
 // ---------------------------------------------------------------------------
 // Menús interactivos (cada uno limpia la pantalla antes de mostrarse)
 // ---------------------------------------------------------------------------
 int main_menu(void) {
     clear();
-    WINDOW *menu_win = newwin(10, 40, (LINES - 10) / 2, (COLS - 40) / 2);
+    WINDOW *menu_win = newwin(11, 40, (LINES - 11) / 2, (COLS - 40) / 2);
     box(menu_win, 0, 0);
     mvwprintw(menu_win, 1, 2, "POS System Main Menu");
     mvwprintw(menu_win, 3, 2, "1. Manage Products");
@@ -280,9 +351,10 @@ int main_menu(void) {
     mvwprintw(menu_win, 5, 2, "3. View Tickets");
     mvwprintw(menu_win, 6, 2, "4. Agent Login");
     mvwprintw(menu_win, 7, 2, "5. Sales (POS)");
-    mvwprintw(menu_win, 8, 2, "6. Exit");
+    mvwprintw(menu_win, 8, 2, "6. Reports (X/Z)");
+    mvwprintw(menu_win, 9, 2, "7. Exit");
     wrefresh(menu_win);
-    int ch = wgetch(menu_win);
+    int ch = read_key(menu_win);
     delwin(menu_win);
     clear();
     return ch;
@@ -320,14 +392,19 @@ int manage_users_menu(void) {
     return ch;
 }
 
-int view_tickets_menu(void) {
+/* Pide dónde empezar (ticket o fecha) y un agente opcional. */
+int view_tickets_menu(char *query, int query_size, char *agent, int agent_size) {
     clear();
-    WINDOW *menu_win = newwin(6, 40, (LINES - 6) / 2, (COLS - 40) / 2);
+    WINDOW *menu_win = newwin(9, 56, (LINES - 9) / 2, (COLS - 56) / 2);
     box(menu_win, 0, 0);
     mvwprintw(menu_win, 1, 2, "View Tickets");
-    mvwprintw(menu_win, 3, 2, "Press any key to view tickets...");
+    mvwprintw(menu_win, 3, 2, "Ticket # or date YYYY-MM-DD (Enter = all):");
+    mvwprintw(menu_win, 5, 2, "Agent (Enter = all):");
     wrefresh(menu_win);
-    wgetch(menu_win);
+    echo();
+    mvwgetnstr(menu_win, 4, 4, query, query_size - 1);
+    mvwgetnstr(menu_win, 6, 4, agent, agent_size - 1);
+    noecho();
     delwin(menu_win);
     clear();
     return 0;
@@ -340,7 +417,7 @@ int pos_sale_menu(void) {
     mvwprintw(menu_win, 1, 2, "Sales (POS)");
     mvwprintw(menu_win, 3, 2, "Press any key to start sale...");
     wrefresh(menu_win);
-    wgetch(menu_win);
+    read_key(menu_win);
     delwin(menu_win);
     clear();
     return 0;
@@ -359,6 +436,21 @@ int agent_login_menu(void) {
     return 0;
 }
 
+int reports_menu(void) {
+    clear();
+    WINDOW *menu_win = newwin(8, 40, (LINES - 8) / 2, (COLS - 40) / 2);
+    box(menu_win, 0, 0);
+    mvwprintw(menu_win, 1, 2, "Reports");
+    mvwprintw(menu_win, 3, 2, "1. X Report (current period)");
+    mvwprintw(menu_win, 4, 2, "2. Z Report (close period)");
+    mvwprintw(menu_win, 5, 2, "3. Back");
+    wrefresh(menu_win);
+    int ch = wgetch(menu_win);
+    delwin(menu_win);
+    clear();
+    return ch;
+}
+
 // ---------------------------------------------------------------------------
 // Funciones de gestión de productos
 // ---------------------------------------------------------------------------
@@ -367,8 +459,8 @@ int agent_login_menu(void) {
    y se muestran "páginas" que se avanzan al pulsar una tecla. */
 void view_products(void) {
     clear();
-    FILE *file = fopen(PRODUCTS_FILE, "rb");
-    if (!file) {
+    size_t count = catalog_count(&catalog);
+    if (count == 0) {
         mvprintw(0, 0, "No products found. Press any key to return.");
         getch();
         clear();
@@ -378,25 +470,26 @@ void view_products(void) {
     int lines_per_page = LINES - 3; // Reservamos líneas para cabecera y mensaje
     int current_line = 0;
     Product prod;
-    while (fread(&prod, sizeof(Product), 1, file) == 1) {
+    char price[MONEY_BUFSIZE];
+    for (size_t pos = 0; pos < count; pos++) {
+        if (!catalog_get(&catalog, pos, &prod))
+            continue; // Lápida pendiente de compactar
         if (current_line % lines_per_page == 0) {
             clear();
             mvprintw(0, 0, "Product List - Page %d (Press any key for next page, 'q' to quit)", page);
             mvprintw(1, 0, "ID\tProduct\t\tPrice\tStock");
         }
-        mvprintw(2 + (current_line % lines_per_page), 0, "%d\t%-15s\t%.2f\t%d", prod.ID, prod.product, prod.price, prod.stock);
+        mvprintw(2 + (current_line % lines_per_page), 0, "%d\t%-15s\t%s\t%d", prod.ID, prod.product, amount_text(prod.price, price), prod.stock);
         current_line++;
         if (current_line % lines_per_page == 0) {
             int ch = getch();
             if (ch == 'q' || ch == 'Q') {
-                fclose(file);
                 clear();
                 return;
             }
             page++;
         }
     }
-    fclose(file);
     mvprintw(LINES - 1, 0, "End of list. Press any key to return.");
     getch();
     clear();
@@ -462,17 +555,33 @@ void form_add_product(void) {
     form_driver(my_form, REQ_NEXT_FIELD);
     unpost_form(my_form);
     refresh();
+    Money prices[5];
+    static const int price_fields[5] = { 1, 3, 4, 5, 6 };
+    for (int i = 0; i < 5; i++) {
+        if (!parse_amount(field_buffer(field[price_fields[i]], 0), &prices[i])) {
+            mvprintw(20, 2, "Invalid price: %s", field_buffer(field[price_fields[i]], 0));
+            mvprintw(22, 2, "Press any key to continue...");
+            getch();
+            free_form(my_form);
+            for (int j = 0; j < 7; j++) {
+                free_field(field[j]);
+            }
+            clear();
+            return;
+        }
+    }
     Product new_prod;
+    memset(&new_prod, 0, sizeof(new_prod));
     int last_id = read_last_id(LAST_ID_FILE);
     new_prod.ID = last_id + 1;
     strncpy(new_prod.product, field_buffer(field[0], 0), sizeof(new_prod.product) - 1);
     new_prod.product[sizeof(new_prod.product) - 1] = '\0';
-    new_prod.price = atof(field_buffer(field[1], 0));
+    new_prod.price = prices[0];
     new_prod.stock = atoi(field_buffer(field[2], 0));
-    new_prod.price01 = atof(field_buffer(field[3], 0));
-    new_prod.price02 = atof(field_buffer(field[4], 0));
-    new_prod.price03 = atof(field_buffer(field[5], 0));
-    new_prod.price04 = atof(field_buffer(field[6], 0));
+    new_prod.price01 = prices[1];
+    new_prod.price02 = prices[2];
+    new_prod.price03 = prices[3];
+    new_prod.price04 = prices[4];
     // Los demás campos se dejan vacíos.
     if (add_product_disk(&new_prod)) {
         update_last_id(LAST_ID_FILE, new_prod.ID);
@@ -586,53 +695,74 @@ void agent_login(void) {
 // ---------------------------------------------------------------------------
 // Función de ventas (POS)
 // ---------------------------------------------------------------------------
+/* Explica por qué no se puede vender y vuelve al menú. */
+void sales_unavailable(const char *reason, const char *detail) {
+    clear();
+    mvprintw(0, 0, "Sales are not available: %s.", reason);
+    mvprintw(1, 0, "%s", detail);
+    mvprintw(LINES - 1, 0, "Press any key to return.");
+    getch();
+    clear();
+}
+
 void pos_sale(void) {
-    char id_str[10], qty_str[10];
+    char query[20], qty_str[10];
     Product prod;
+    // Sin existencias al día no se vende: el ticket y su descuento van juntos.
+    if (!stock_ready) {
+        sales_unavailable("stock could not be brought up to date", stock_log.error);
+        return;
+    }
+    if (catalog_failed(&catalog)) {
+        sales_unavailable("the product catalog could not be reopened", catalog.error);
+        return;
+    }
+    // El fallo del diario dura hasta reiniciar: esta venta tampoco se guardaría.
+    if (ticket_writer.failed) {
+        sales_unavailable("tickets cannot be saved; restart the POS", ticket_writer.error);
+        return;
+    }
     while (1) {
         clear();
-        mvprintw(0, 0, "Enter Product ID (0 to finish): ");
-        echo();
-        getstr(id_str);
-        noecho();
-        int id = atoi(id_str);
-        if (id == 0)
+        show_writer_alert(stdscr);
+        mvprintw(0, 0, "Enter Product ID or EAN-13 (0 to finish): ");
+        read_line(query, sizeof(query));
+        if (strlen(query) < 13 && atoi(query) == 0)
             break;
-        char query[20];
-        sprintf(query, "%d", id);
         if (!search_product_disk(query, &prod)) {
             mvprintw(2, 0, "Product not found. Press any key to continue...");
             getch();
             continue;
         }
         mvprintw(2, 0, "Enter Quantity: ");
-        echo();
-        getstr(qty_str);
-        noecho();
+        read_line(qty_str, sizeof(qty_str));
         int qty = atoi(qty_str);
         if (qty <= 0) {
             mvprintw(3, 0, "Invalid quantity. Press any key...");
             getch();
             continue;
         }
-        for (int i = 0; i < qty && cart_count < MAX_CART; i++) {
-            Product *p = malloc(sizeof(Product));
-            if (p) {
-                *p = prod;
-                shopping_cart[cart_count++] = p;
-                total += prod.price;
-            }
-        }
-        mvprintw(4, 0, "Added %d of product '%s'.", qty, prod.product);
+        if (cart_add(&cart, &prod, qty))
+            mvprintw(4, 0, "Added %d of product '%s'.", qty, prod.product);
+        else
+            mvprintw(4, 0, "Cannot add %d of product '%s'.", qty, prod.product);
         mvprintw(5, 0, "Press any key to continue...");
         getch();
     }
+    // Sin productos no hay venta: ni cobro ni ticket.
+    if (cart.count == 0) {
+        cart_reset(&cart);
+        clear();
+        return;
+    }
     // Resumen de venta y pago
     clear();
     mvprintw(0, 0, "Sale Summary:");
+    char amount[MONEY_BUFSIZE];
     int row = 2;
-    for (int i = 0; i < cart_count; i++) {
-        mvprintw(row++, 0, "%d. %s - %.2f", i + 1, shopping_cart[i]->product, shopping_cart[i]->price);
+    for (size_t i = 0; i < cart.count; i++) {
+        const CartLine *line = &cart.lines[i];
+        mvprintw(row++, 0, "%zu. %s x %d - %s", i + 1, line->name, line->qty, amount_text(line->unit_price, amount));
         if (row >= LINES - 3) {
             mvprintw(LINES - 2, 0, "Press any key for next page...");
             getch();
@@ -640,31 +770,258 @@ void pos_sale(void) {
             row = 2;
         }
     }
-    mvprintw(row++, 0, "Total: %.2f", total);
+    mvprintw(row++, 0, "Total: %s", amount_text(cart.total, amount));
+    // Se vuelve a pedir hasta que el importe se entienda y cubra el total;
+    // vacío o ESC anula la venta sin guardar nada.
     char paid_str[20];
-    mvprintw(row++, 0, "Enter amount paid: ");
-    echo();
-    getstr(paid_str);
-    noecho();
-    float paid = atof(paid_str);
-    float change = paid - total;
-    mvprintw(row++, 0, "Change: %.2f", change);
+    Money paid;
+    int paid_row = row++;
+    while (1) {
+        move(paid_row, 0);
+        clrtoeol();
+        mvprintw(paid_row, 0, "Enter amount paid (empty or ESC to cancel): ");
+        if (!read_line(paid_str, sizeof(paid_str)) || paid_str[0] == '\0') {
+            cart_reset(&cart);
+            clear();
+            return;
+        }
+        if (parse_amount(paid_str, &paid) && paid >= cart.total)
+            break;
+        mvprintw(row, 0, "Invalid amount: at least %s is due.", amount_text(cart.total, amount));
+    }
+    move(row, 0);
+    clrtoeol();
+    money_format(paid - cart.total, amount);
+    mvprintw(row++, 0, "Change: %s", amount);
     mvprintw(row++, 0, "Press any key to complete sale...");
     getch();
-    save_transaction(TRANSACTIONS_FILE, shopping_cart, cart_count, total);
-    for (int i = 0; i < cart_count; i++) {
-        free(shopping_cart[i]);
+    if (!save_transaction(&ticket_writer, &cart, paid)) {
+        mvprintw(row++, 0, "Warning: ticket could not be saved (%s). Press any key...",
+                 ticket_writer.failed ? ticket_writer.error : ticket_seq.error[0] ? ticket_seq.error : "out of memory");
+        getch();
     }
-    cart_count = 0;
-    total = 0.0;
+    cart_reset(&cart);
     clear();
 }
 
+// ---------------------------------------------------------------------------
+// Tickets
+// ---------------------------------------------------------------------------
+/* Listado paginado de líneas sueltas, para tickets e informes. */
+typedef struct {
+    const char *title;
+    int         count;
+    int         page;
+    bool        quit;         // El usuario pulsó 'q'
+} Pager;
+
+static void page_line(const char *line, void *ctx) {
+    Pager *pager = ctx;
+    int lines_per_page = LINES - 3;
+    if (pager->quit)
+        return;
+    if (pager->count % lines_per_page == 0) {
+        clear();
+        mvprintw(0, 0, "%s - Page %d (Press any key for next page, 'q' to quit)", pager->title, pager->page);
+    }
+    mvprintw(1 + (pager->count % lines_per_page), 0, "%s", line);
+    pager->count++;
+    if (pager->count % lines_per_page == 0) {
+        int ch = getch();
+        if (ch == 'q' || ch == 'Q')
+            pager->quit = true;
+        pager->page++;
+    }
+}
+
+/* Cada ticket ocupa una línea de cabecera y una por producto. */
+static void page_ticket(Pager *pager, const TicketHeader *ticket) {
+    char line[TICKET_TEXT_SIZE];
+    ticket_header_text(ticket, line, sizeof(line));
+    page_line(line, pager);
+    const char *name = ticket_names(ticket);
+    for (uint32_t i = 0; i < ticket->line_count && !pager->quit; i++) {
+        ticket_line_text(&ticket_lines(ticket)[i], name, line, sizeof(line));
+        page_line(line, pager);
+        name += strlen(name) + 1;
+    }
+}
+
+/*
+  Lista los tickets paginados. La consulta puede ser un número de ticket
+  (se empieza en él) o una fecha (solo ese día). Los pies de los segmentos
+  sellados descartan los que no pueden tener lo buscado, y en cada segmento
+  el índice lleva directamente al primer ticket.
+*/
+void view_tickets(const char *query, const char *agent) {
+    int64_t from = INT64_MIN, to = INT64_MAX;
+    char *rest;
+    unsigned long long id = strtoull(query, &rest, 10);
+    bool by_date = ticket_time_parse(query, &from, &to);
+    bool by_id = !by_date && *query != '\0' && *rest == '\0';
+    size_t agent_len = strlen(agent);
+    Pager pager = { .title = "Tickets", .count = 0, .page = 1, .quit = false };
+    JournalSegments segments;
+    bool listed = (by_date || by_id || *query == '\0') && journal_segments_open(&segments, JOURNAL_FILE);
+    bool done = false;
+    for (size_t i = 0; listed && i < segments.count && !done && !pager.quit; i++) {
+        const JournalSegment *seg = &segments.items[i];
+        if (!journal_segment_has_time(seg, from, to) || (by_id && !journal_segment_has_ticket(seg, id)) ||
+            (agent_len > 0 && !journal_segment_has_agent(seg, agent, agent_len)))
+            continue;
+        JournalReader reader;
+        TicketIndex index;
+        if (!journal_reader_open(&reader, seg->filename) || !reader.map)
+            continue;
+        ticket_index_open(&index, seg->filename, &reader, false);
+        journal_seek(&reader, reader.start);
+        bool found = true;
+        if (by_date) {
+            found = ticket_index_seek_time(&index, &reader, from);
+        } else if (by_id) {
+            const TicketHeader *ticket = ticket_index_find(&index, &reader, id);
+            found = ticket != NULL;
+            if (found) {
+                // A partir de este ticket se listan todos los segmentos que siguen.
+                journal_seek(&reader, (size_t)((const char *)ticket - reader.map));
+                by_id = false;
+            }
+        }
+        const TicketHeader *ticket;
+        while (found && !pager.quit && (ticket = agent_len ? ticket_index_next_agent(&index, &reader, agent, agent_len)
+                                                           : journal_next(&reader)) != NULL) {
+            if (ticket->timestamp >= to) {
+                done = true;
+                break;
+            }
+            page_ticket(&pager, ticket);
+        }
+        ticket_index_close(&index);
+        journal_reader_close(&reader);
+    }
+    if (listed)
+        journal_segments_close(&segments);
+    if (pager.count == 0) {
+        clear();
+        mvprintw(0, 0, "No tickets found.");
+    }
+    mvprintw(LINES - 1, 0, "Press any key to return.");
+    getch();
+}
+
+// ---------------------------------------------------------------------------
+// Informes X y Z
+// ---------------------------------------------------------------------------
+/*
+  El escritor avisa de cada ticket ya en disco: se descuentan sus
+  existencias y se suma a los acumulados.
+*/
+void ticket_committed(const TicketHeader *ticket, const Journal *journal, uint64_t end, void *ctx) {
+    (void)ctx;
+    if (stock_ready)
+        stock_log_add(&stock_log, ticket, journal->segment, journal->created, end);
+    if (reports_ready)
+        report_add(&sales_report, ticket, journal->segment, journal->created, end);
+}
+
+/* Muestra el X del periodo en curso o cierra el periodo con un Z. */
+void show_report(bool z) {
+    if (!reports_ready) {
+        mvprintw(0, 0, "Reports are not available.");
+        mvprintw(LINES - 1, 0, "Press any key to return.");
+        getch();
+        return;
+    }
+    // Los tickets aún en la cola también cuentan.
+    ticket_writer_flush(&ticket_writer);
+    ReportTotals totals;
+    if (z) {
+        if (!report_close_period(&sales_report, &totals)) {
+            mvprintw(0, 0, "Z report failed: %s", sales_report.error);
+            mvprintw(LINES - 1, 0, "Press any key to return.");
+            getch();
+            return;
+        }
+    } else {
+        report_snapshot(&sales_report, &totals);
+    }
+    Pager pager = { .title = "Report", .count = 0, .page = 1, .quit = false };
+    report_text(&totals, z, page_line, &pager);
+    mvprintw(LINES - 1, 0, "Press any key to return.");
+    getch();
+}
+
 // ---------------------------------------------------------------------------
 // Función principal
 // ---------------------------------------------------------------------------
 int main(void) {
     load_config(CONFIG_FILE);
+    if (!catalog_open(&catalog, PRODUCTS_FILE)) {
+        fprintf(stderr, "Cannot open product catalog '%s': %s\n", PRODUCTS_FILE, catalog.error);
+        return 1;
+    }
+    catalog.compact_ratio = compact_ratio;
+    catalog_compact_if_needed(&catalog);
+    if (!journal_open(&journal, JOURNAL_FILE)) {
+        fprintf(stderr, "Cannot open ticket journal '%s': %s\n", JOURNAL_FILE, journal.error);
+        catalog_close(&catalog);
+        return 1;
+    }
+    if (journal_sync_us > 0)
+        journal.sync_window_us = journal_sync_us < JOURNAL_MAX_SYNC_WINDOW
+            ? (unsigned)journal_sync_us : JOURNAL_MAX_SYNC_WINDOW;
+    journal.segment_bytes = journal_segment_mb > 0 ? (uint64_t)journal_segment_mb << 20 : 0;
+    journal.segment_daily = journal_daily_segments;
+    // El índice y los informes se ponen al día con el diario y luego los
+    // mantiene el escritor.
+    JournalReader reader;
+    if (journal_reader_open(&reader, JOURNAL_FILE)) {
+        if (ticket_index_open(&ticket_index, JOURNAL_FILE, &reader, true))
+            journal.index = &ticket_index;
+        else
+            ticket_index_close(&ticket_index);
+        journal_reader_close(&reader);
+    }
+    // Las existencias de los tickets que ya estaban en disco pero no en el
+    // catálogo se descuentan ahora, antes de vender; si no se puede, no se
+    // vende (ver pos_sale()).
+    stock_ready = stock_log_open(&stock_log, STOCK_FILE, &catalog, JOURNAL_FILE);
+    if (stock_log.error[0])
+        fprintf(stderr, "Stock: %s\n", stock_log.error);
+    if (!stock_ready)
+        stock_log_close(&stock_log);
+    reports_ready = report_open(&sales_report, REPORT_FILE, &catalog, JOURNAL_FILE);
+    if (sales_report.error[0])
+        fprintf(stderr, "Reports: %s\n", sales_report.error);
+    if (!reports_ready)
+        report_close(&sales_report);
+    // Sin arriendo todavía, los tickets siguen donde los dejó last_id.txt.
+    if (!ticket_seq_open(&ticket_seq, TICKET_LEASE_FILE, (uint64_t)read_last_id(LAST_ID_FILE),
+                         &journal, TICKET_SEQ_BLOCK)) {
+        fprintf(stderr, "Cannot start ticket numbering: %s\n", ticket_seq.error);
+        if (reports_ready)
+            report_close(&sales_report);
+        if (stock_ready)
+            stock_log_close(&stock_log);
+        ticket_index_close(&ticket_index);
+        journal_close(&journal);
+        catalog_close(&catalog);
+        return 1;
+    }
+    if (!ticket_writer_start(&ticket_writer, &journal,
+                             reports_ready || stock_ready ? ticket_committed : NULL, NULL)) {
+        fprintf(stderr, "Cannot start ticket writer: %s\n", ticket_writer.error);
+        if (reports_ready)
+            report_close(&sales_report);
+        if (stock_ready)
+            stock_log_close(&stock_log);
+        ticket_seq_close(&ticket_seq);
+        ticket_index_close(&ticket_index);
+        journal_close(&journal);
+        catalog_close(&catalog);
+        return 1;
+    }
+    cart_init(&cart);
     init_ncurses();
     int choice;
     bool running = true;
@@ -702,35 +1059,10 @@ int main(void) {
                 break;
             }
             case '3': { // View Tickets
-                view_tickets_menu();
-                clear();
-                FILE *file = fopen(TRANSACTIONS_FILE, "r");
-                if (file) {
-                    char line[256];
-                    int page = 1;
-                    int lines_per_page = LINES - 3;
-                    int count = 0;
-                    while (fgets(line, sizeof(line), file)) {
-                        if (count % lines_per_page == 0) {
-                            clear();
-                            mvprintw(0, 0, "Tickets - Page %d (Press any key for next page, 'q' to quit)", page);
-                        }
-                        mvprintw(1 + (count % lines_per_page), 0, "%s", line);
-                        count++;
-                        if (count % lines_per_page == 0) {
-                            int ch = getch();
-                            if (ch == 'q' || ch == 'Q')
-                                break;
-                            page++;
-                        }
-                    }
-                    fclose(file);
-                } else {
-                    mvprintw(0, 0, "No tickets found.");
-                    getch();
-                }
-                mvprintw(LINES - 1, 0, "Press any key to return.");
-                getch();
+                char query[32], agent[JOURNAL_AGENT_SIZE];
+                view_tickets_menu(query, sizeof(query), agent, sizeof(agent));
+                ticket_writer_flush(&ticket_writer);
+                view_tickets(query, agent);
                 clear();
                 break;
             }
@@ -744,7 +1076,21 @@ int main(void) {
                 pos_sale();
                 break;
             }
-            case '6': { // Exit
+            case '6': { // Reports (X/Z)
+                int r_choice;
+                bool report_running = true;
+                while (report_running) {
+                    r_choice = reports_menu();
+                    switch (r_choice) {
+                        case '1': show_report(false); break;
+                        case '2': show_report(true); break;
+                        case '3': report_running = false; break;
+                        default: break;
+                    }
+                }
+                break;
+            }
+            case '7': { // Exit
                 running = false;
                 break;
             }
@@ -752,5 +1098,17 @@ int main(void) {
         }
     }
     cleanup_ncurses();
+    cart_free(&cart);
+    ticket_writer_stop(&ticket_writer);
+    if (ticket_writer.failed)
+        fprintf(stderr, "Some tickets were not saved: %s\n", ticket_writer.error);
+    if (reports_ready)
+        report_close(&sales_report);
+    if (stock_ready)
+        stock_log_close(&stock_log);
+    ticket_seq_close(&ticket_seq);
+    ticket_index_close(&ticket_index);
+    journal_close(&journal);
+    catalog_close(&catalog);
     return 0;
 }
@@ -0,0 +1,91 @@
+/*
+  Conversión entre texto decimal y céntimos, sin float ni printf.
+*/
+
+#include "money.h"
+
+#include <string.h>
+
+// Tope de la parte entera: por encima el importe no cabe en céntimos de 64 bits.
+#define MONEY_MAX_UNITS 10000000000000000ULL
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+/**
+ * Convierte un importe decimal a céntimos. Acepta signo, espacios a los
+ * lados y '.' o ',' como separador decimal; a partir del tercer decimal se
+ * redondea a medio céntimo hacia fuera.
+ *
+ * @param text  Texto del importe (no hace falta que termine en '\0')
+ * @param len   Longitud del texto
+ * @param out   Importe en céntimos
+ * @return      false si el texto no es un importe o no cabe en 64 bits
+ */
+bool money_parse(const char *text, size_t len, Money *out) {
+    const char *p = text;
+    const char *end = text + len;
+    while (p < end && is_blank(*p)) p++;
+    while (end > p && is_blank(end[-1])) end--;
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t units = 0;
+    int digits = 0;
+    for (; p < end && is_digit(*p); p++, digits++) {
+        units = units * 10 + (uint64_t)(*p - '0');
+        if (units >= MONEY_MAX_UNITS)
+            return false;
+    }
+    uint64_t cents = units * 100;
+    if (p < end && (*p == '.' || *p == ',')) {
+        int decimals = 0;
+        for (p++; p < end && is_digit(*p); p++, digits++, decimals++) {
+            int d = *p - '0';
+            if (decimals == 0)
+                cents += (uint64_t)d * 10;
+            else if (decimals == 1)
+                cents += (uint64_t)d;
+            else if (decimals == 2)
+                cents += d >= 5;
+        }
+    }
+    if (p != end || digits == 0)
+        return false;
+    *out = negative ? -(Money)cents : (Money)cents;
+    return true;
+}
+
+/**
+ * Escribe un importe con dos decimales ("-1234.05") terminado en '\0'.
+ *
+ * @param buf  Destino de al menos MONEY_BUFSIZE bytes
+ * @return     Longitud del texto, sin contar el '\0'
+ */
+size_t money_format(Money cents, char *buf) {
+    char tmp[MONEY_BUFSIZE];
+    char *p = tmp + sizeof(tmp);
+    uint64_t v = cents < 0 ? -(uint64_t)cents : (uint64_t)cents;
+    *--p = (char)('0' + v % 10);
+    v /= 10;
+    *--p = (char)('0' + v % 10);
+    v /= 10;
+    *--p = '.';
+    do {
+        *--p = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (cents < 0)
+        *--p = '-';
+    size_t len = (size_t)(tmp + sizeof(tmp) - p);
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    return len;
+}
@@ -0,0 +1,29 @@
+/*
+  Importes en céntimos.
+
+  Los precios se leen y se escriben como texto decimal ("199.99") sin pasar
+  por float ni por las funciones de la libc que dependen del locale: el texto
+  se convierte directamente a céntimos enteros y los céntimos vuelven a texto
+  con dos decimales, de modo que un importe da siempre el mismo resultado.
+*/
+#ifndef MONEY_H
+#define MONEY_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int64_t Money;        // Céntimos
+
+#define MONEY_BUFSIZE 24      // Signo, 19 dígitos, punto y '\0'
+
+bool   money_parse(const char *text, size_t len, Money *out);
+size_t money_format(Money cents, char *buf);
+
+/* Precio en float de los formatos antiguos, redondeado al céntimo. */
+static inline Money money_from_float(float value) {
+    return (Money)llroundf(value * 100.0f);
+}
+
+#endif
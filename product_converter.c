@@ -1,302 +1,587 @@
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-#define MAX_PRODUCTS 10000
+#include "catalog.h"
+#include "csv.h"
+#include "money.h"
+
+#define BATCH_ROWS 1024  // Registros por lote: la memoria no depende del tamaño del archivo
 #define MAX_FIELDS 19  // Actualizado para incluir los nuevos campos de descripción
 
-typedef struct {
-    int    ID;
-    char   EAN13[14];         // Código EAN13: 13 caracteres + terminador nulo
-    char   product[100];      // Aumentado para acomodar descripciones más largas
-    float  price;
-    int    stock;
-    float  price01;
-    float  price02;
-    float  price03;
-    float  price04;
-    char   fabricante[50];    // Fabricante
-    char   proveedor[50];     // Proveedor
-    char   departamento[50];  // Departamento
-    char   clase[50];         // Clase
-    char   subclase[50];      // Subclase
-    char   tipo_IVA[20];      // Tipo de IVA: "reducido" o "super reducido"
-    char   descripcion1[100]; // Nuevos campos de descripción
-    char   descripcion2[100];
-    char   descripcion3[100];
-    char   descripcion4[100];
-} Product;
 
 /**
- * Función auxiliar para eliminar espacios en blanco al inicio y al final de una cadena.
+ * Lee un precio en céntimos; un campo vacío vale 0, como con atof().
+ *
+ * @return  false si el campo no es un importe, es demasiado largo o no cabe
+ *          en el catálogo
  */
-void trim(char *str) {
-    // Eliminar espacios al inicio
-    char *start = str;
-    while(isspace((unsigned char)*start)) start++;
-    if(start != str) memmove(str, start, strlen(start) + 1);
-
-    // Eliminar espacios al final
-    char *end = str + strlen(str) - 1;
-    while(end > str && isspace((unsigned char)*end)) end--;
-    *(end+1) = '\0';
+static bool price_from_field(const CsvField *field, Money *out) {
+    char text[32];
+    *out = 0;
+    // Recortado podría leerse como otro importe válido.
+    if (field->len >= sizeof(text))
+        return false;
+    size_t len = csv_copy(field, text, sizeof(text));
+    if (len > 0 && !money_parse(text, len, out))
+        return false;
+    return *out >= -(Money)CATALOG_PRICE_MAX && *out <= CATALOG_PRICE_MAX;
 }
 
 /**
- * Función para parsear una línea de CSV respetando comillas.
- * Retorna la cantidad de campos parseados.
+ * Rellena un Product a partir de los campos de una línea CSV ya partida.
+ *
+ * @param fields  Los MAX_FIELDS campos de la línea
+ * @param out     Registro a rellenar
+ * @return        NULL si el registro es válido, o el motivo para descartarlo
  */
-int parse_csv_line(char *line, char **fields, int max_fields) {
-    int count = 0;
-    char *ptr = line;
-    while (*ptr && count < max_fields) {
-        // Si el campo comienza con comillas
-        if (*ptr == '\"') {
-            ptr++; // Saltar la comilla inicial
-            fields[count++] = ptr;
-            // Buscar la comilla de cierre
-            while (*ptr && !(*ptr == '\"' && (*(ptr+1) == ',' || *(ptr+1) == '\0' || *(ptr+1) == '\n'))) {
-                if (*ptr == '\"' && *(ptr+1) == '\"') {
-                    // Doble comilla encontrada, saltar una
-                    memmove(ptr, ptr+1, strlen(ptr));
-                }
-                ptr++;
-            }
-            if (*ptr == '\"') {
-                *ptr = '\0'; // Terminar el campo
-                ptr += 2; // Saltar la comilla de cierre y la coma
-            }
-        } else {
-            // Campo sin comillas
-            fields[count++] = ptr;
-            while (*ptr && *ptr != ',') ptr++;
-            if (*ptr == ',') {
-                *ptr = '\0';
-                ptr++;
+static const char *product_from_fields(const CsvField *fields, Product *out) {
+    char number[32];
+    memset(out, 0, sizeof(Product));
+
+    // Asignar campos al struct
+    csv_copy(&fields[0], number, sizeof(number));
+    out->ID = atoi(number);
+    csv_copy(&fields[1], out->EAN13, sizeof(out->EAN13));
+    csv_copy(&fields[2], out->product, sizeof(out->product));
+    csv_copy(&fields[4], number, sizeof(number));
+    out->stock = atoi(number);
+    if (!price_from_field(&fields[3], &out->price) ||
+        !price_from_field(&fields[5], &out->price01) ||
+        !price_from_field(&fields[6], &out->price02) ||
+        !price_from_field(&fields[7], &out->price03) ||
+        !price_from_field(&fields[8], &out->price04))
+        return "Precio inválido en línea";
+    csv_copy(&fields[9], out->fabricante, sizeof(out->fabricante));
+    csv_copy(&fields[10], out->proveedor, sizeof(out->proveedor));
+    csv_copy(&fields[11], out->departamento, sizeof(out->departamento));
+    csv_copy(&fields[12], out->clase, sizeof(out->clase));
+    csv_copy(&fields[13], out->subclase, sizeof(out->subclase));
+    csv_copy(&fields[14], out->tipo_IVA, sizeof(out->tipo_IVA));
+    csv_copy(&fields[15], out->descripcion1, sizeof(out->descripcion1));
+    csv_copy(&fields[16], out->descripcion2, sizeof(out->descripcion2));
+    csv_copy(&fields[17], out->descripcion3, sizeof(out->descripcion3));
+    csv_copy(&fields[18], out->descripcion4, sizeof(out->descripcion4));
+
+    // Validar que tipo_IVA sea "reducido" o "super reducido"
+    if (strcasecmp(out->tipo_IVA, "reducido") != 0 && strcasecmp(out->tipo_IVA, "super reducido") != 0)
+        return "Tipo de IVA inválido en línea";
+    return NULL;
+}
+
+/**
+ * Añade los productos de un trozo al catálogo en construcción.
+ *
+ * @return  false si falla la escritura
+ */
+static bool write_batch(CatalogWriter *writer, const Product *batch, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!catalog_writer_add(writer, &batch[i]))
+            return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Importación en paralelo
+// ---------------------------------------------------------------------------
+// El hilo principal lee el CSV en trozos de CHUNK_BYTES cortados siempre en
+// un límite de registro, los hilos de trabajo los parsean y validan, y el
+// hilo principal los escribe en el mismo orden en que los leyó. Hay dos
+// trozos en vuelo por hilo, así que la memoria no depende del archivo.
+//
+// Si el archivo se puede proyectar en memoria, cada trozo es una vista sobre
+// la proyección y los campos se copian una sola vez, al Product final; si no
+// (una tubería, por ejemplo), se lee con fread a un búfer por trozo.
+#define CHUNK_BYTES    (256 * 1024)
+#define MAX_THREADS    256
+
+typedef enum { CHUNK_FREE, CHUNK_FILLED, CHUNK_PARSED } ChunkState;
+
+typedef struct {
+    ChunkState state;
+    unsigned long seq;        // Orden del trozo en el archivo
+    const char *text;         // Registros completos: la proyección o 'data'
+    size_t     len;
+    char      *data;          // Búfer propio cuando no hay proyección
+    size_t     capacity;
+    Product   *products;      // Registros válidos, en orden
+    size_t     count;
+    size_t     product_capacity;
+    char      *warnings;      // Avisos de líneas descartadas, ya formateados
+    size_t     warnings_len;
+    size_t     warnings_capacity;
+    bool       failed;        // Sin memoria al parsear
+} Chunk;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    Chunk     *chunks;
+    size_t     nchunks;
+    unsigned long filled;     // Trozos leídos
+    unsigned long next_parse; // Siguiente trozo para un hilo de trabajo
+    bool       done;
+} ImportPool;
+
+typedef struct {
+    const char *map;          // Archivo proyectado (NULL = leer de 'f')
+    size_t     map_size;
+    size_t     pos;           // Inicio del siguiente trozo en la proyección
+    FILE      *f;
+    char      *carry;         // Registro a medias del final del trozo anterior
+    size_t     carry_len;
+    size_t     carry_capacity;
+    bool       eof;
+} ChunkReader;
+
+static bool grow_buffer(char **buf, size_t *capacity, size_t needed) {
+    if (needed <= *capacity)
+        return true;
+    size_t cap = *capacity ? *capacity : CHUNK_BYTES;
+    while (cap < needed) cap *= 2;
+    char *p = realloc(*buf, cap);
+    if (!p)
+        return false;
+    *buf = p;
+    *capacity = cap;
+    return true;
+}
+
+/**
+ * Llena un trozo con los registros completos que quepan. Lo que sobra tras
+ * el último registro completo pasa al siguiente trozo; si ni un registro
+ * cabe, el trozo crece hasta contenerlo.
+ *
+ * @return  false si falla la lectura o no hay memoria
+ */
+static bool fill_chunk(ChunkReader *r, Chunk *chunk) {
+    if (!grow_buffer(&chunk->data, &chunk->capacity, r->carry_len + 1))
+        return false;
+    if (r->carry_len > 0)
+        memcpy(chunk->data, r->carry, r->carry_len);
+    size_t len = r->carry_len;
+    const char *split;
+    for (;;) {
+        if (!r->eof) {
+            len += fread(chunk->data + len, 1, chunk->capacity - len, r->f);
+            if (len < chunk->capacity) {
+                if (ferror(r->f))
+                    return false;
+                r->eof = true;
             }
         }
+        const char *p = chunk->data;
+        const char *end = chunk->data + len;
+        const char *next;
+        while (p < end && (next = csv_record_end(p, end, r->eof)) != NULL)
+            p = next;
+        if (p > chunk->data || r->eof) {
+            split = p;
+            break;
+        }
+        if (!grow_buffer(&chunk->data, &chunk->capacity, chunk->capacity * 2))
+            return false;
+    }
 
-        // Trim espacios
-        trim(fields[count-1]);
+    size_t used = (size_t)(split - chunk->data);
+    chunk->text = chunk->data;
+    r->carry_len = len - used;
+    if (r->carry_len > 0) {
+        if (!grow_buffer(&r->carry, &r->carry_capacity, r->carry_len))
+            return false;
+        memcpy(r->carry, split, r->carry_len);
     }
-    return count;
+    chunk->len = used;
+    return true;
 }
 
 /**
- * Lee un archivo CSV con columnas adicionales:
- *   descripcion1, descripcion2, descripcion3, descripcion4
- * y retorna la cantidad de registros leídos en el array 'products'.
- * 
- * @param filename  Nombre del archivo CSV
- * @param products  Arreglo donde se guardan los registros
- * @return          Cantidad de registros leídos
+ * Toma de la proyección un trozo de al menos CHUNK_BYTES (o lo que quede)
+ * que termine en un límite de registro, sin copiar nada.
  */
-int load_from_csv(const char *filename, Product *products) {
-    FILE *f = fopen(filename, "r");
-    if (!f) {
-        perror("No se pudo abrir el archivo CSV");
-        return -1;
-    }
+static void map_chunk(ChunkReader *r, Chunk *chunk) {
+    const char *start = r->map + r->pos;
+    const char *end = r->map + r->map_size;
+    const char *target = end - start > CHUNK_BYTES ? start + CHUNK_BYTES : end;
+    const char *p = start;
+    while (p < target)
+        p = csv_record_end(p, end, true);
+    chunk->text = start;
+    chunk->len = (size_t)(p - start);
+    r->pos += chunk->len;
+}
 
-    int count = 0;
-    char line[2048]; // Aumentado el tamaño para manejar líneas más largas
+/* ¿Queda algo por repartir? */
+static bool reader_pending(const ChunkReader *r) {
+    return r->map ? r->pos < r->map_size : !(r->eof && r->carry_len == 0);
+}
 
-    // Leer la línea de encabezado y verificar si coincide con el formato esperado
-    if (fgets(line, sizeof(line), f)) {
-        // Opcional: verificar encabezados
-        // Puedes implementar una verificación más estricta si lo deseas
+/**
+ * Abre el CSV: lo proyecta en memoria si es un archivo regular y, si no, lo
+ * deja listo para leerlo con fread.
+ *
+ * @return  false si no se puede abrir
+ */
+static bool open_reader(ChunkReader *r, const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            r->map = map;
+            r->map_size = (size_t)st.st_size;
+            return true;
+        }
+    }
+    r->f = fdopen(fd, "r");
+    if (!r->f) {
+        close(fd);
+        return false;
     }
+    return true;
+}
+
+static void close_reader(ChunkReader *r) {
+    if (r->map)
+        munmap((void *)r->map, r->map_size);
+    if (r->f)
+        fclose(r->f);
+    free(r->carry);
+}
 
-    while (fgets(line, sizeof(line), f) && count < MAX_PRODUCTS) {
+/* Guarda en el trozo el aviso de una línea descartada. */
+static bool chunk_warn(Chunk *chunk, const char *message, const char *line, size_t len) {
+    size_t mlen = strlen(message);
+    size_t needed = chunk->warnings_len + mlen + 2 + len + 1;
+    if (!grow_buffer(&chunk->warnings, &chunk->warnings_capacity, needed))
+        return false;
+    char *w = chunk->warnings + chunk->warnings_len;
+    memcpy(w, message, mlen);
+    memcpy(w + mlen, ": ", 2);
+    memcpy(w + mlen + 2, line, len);
+    w[mlen + 2 + len] = '\n';
+    chunk->warnings_len = needed;
+    return true;
+}
+
+/**
+ * Parsea y valida los registros de un trozo. El primer trozo empieza por la
+ * línea de encabezado, que se salta.
+ */
+static void parse_chunk(Chunk *chunk) {
+    const char *p = chunk->text;
+    const char *end = chunk->text + chunk->len;
+    chunk->count = 0;
+    chunk->warnings_len = 0;
+    chunk->failed = false;
+    if (chunk->seq == 0 && p < end)
+        p = csv_record_end(p, end, true);
+
+    while (p < end) {
+        const char *line = p;
+        p = csv_record_end(p, end, true);
         // Saltar líneas vacías o con solo saltos de línea
-        if (line[0] == '\n' || line[0] == '\r') {
+        if (line[0] == '\n' || line[0] == '\r')
             continue;
+
+        size_t len = (size_t)(p - line);
+        size_t shown = len > 0 && line[len - 1] == '\n' ? len - 1 : len;
+        CsvField fields[MAX_FIELDS];
+        int num_fields = csv_split(line, len, fields, MAX_FIELDS);
+
+        if (chunk->count == chunk->product_capacity) {
+            size_t cap = chunk->product_capacity ? chunk->product_capacity * 2 : BATCH_ROWS;
+            Product *grown = realloc(chunk->products, cap * sizeof(Product));
+            if (!grown) {
+                chunk->failed = true;
+                return;
+            }
+            chunk->products = grown;
+            chunk->product_capacity = cap;
         }
 
-        Product temp;
-        memset(&temp, 0, sizeof(Product));
+        const char *invalid = num_fields < 19 // Verificar si hay al menos 19 campos
+            ? "Línea CSV mal formateada o incompleta"
+            : product_from_fields(fields, &chunk->products[chunk->count]);
+        bool ok = true;
+        if (invalid)
+            ok = chunk_warn(chunk, invalid, line, shown);
+        else
+            chunk->count++;
+        if (!ok) {
+            chunk->failed = true;
+            return;
+        }
+    }
+}
 
-        // Array para almacenar punteros a los campos
-        char *fields[MAX_FIELDS];
-        int num_fields = parse_csv_line(line, fields, MAX_FIELDS);
+static void *import_worker(void *arg) {
+    ImportPool *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->done && pool->next_parse == pool->filled)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        if (pool->done)
+            break;
+        Chunk *chunk = &pool->chunks[pool->next_parse++ % pool->nchunks];
+        pthread_mutex_unlock(&pool->lock);
+
+        parse_chunk(chunk);
+
+        pthread_mutex_lock(&pool->lock);
+        chunk->state = CHUNK_PARSED;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
 
-        if (num_fields < 19) { // Verificar si hay al menos 19 campos
-            fprintf(stderr, "Línea CSV mal formateada o incompleta: %s\n", line);
-            continue;
+/**
+ * Convierte un archivo CSV con columnas adicionales:
+ *   descripcion1, descripcion2, descripcion3, descripcion4
+ * en un catálogo binario. El archivo se parte en trozos por límites de
+ * registro (un campo entre comillas puede contener comas y saltos de línea)
+ * que se parsean en paralelo y se escriben en el orden original.
+ *
+ * @param csv_file  Nombre del archivo CSV
+ * @param bin_file  Nombre del archivo binario a generar
+ * @param threads   Hilos que parsean los trozos
+ * @return          Cantidad de registros escritos, o -1 si hubo un error
+ */
+long csv_to_binary(const char *csv_file, const char *bin_file, int threads) {
+    ChunkReader reader = { 0 };
+    if (!open_reader(&reader, csv_file)) {
+        perror("No se pudo abrir el archivo CSV");
+        return -1;
+    }
+    CatalogWriter *writer = catalog_writer_create(bin_file);
+    ImportPool pool = { .nchunks = (size_t)threads * 2 };
+    pool.chunks = calloc(pool.nchunks, sizeof(Chunk));
+    pthread_t *workers = calloc((size_t)threads, sizeof(pthread_t));
+    if (!writer || !pool.chunks || !workers) {
+        perror("No se pudo crear el archivo binario");
+        if (writer) catalog_writer_abort(writer);
+        free(pool.chunks);
+        free(workers);
+        close_reader(&reader);
+        return -1;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+
+    int started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, import_worker, &pool) == 0)
+        started++;
+
+    unsigned long next_write = 0;
+    bool ok = started > 0;
+    bool read_ok = true;
+    while (ok) {
+        // Leer mientras haya trozos libres
+        pthread_mutex_lock(&pool.lock);
+        while (reader_pending(&reader) &&
+               pool.chunks[pool.filled % pool.nchunks].state == CHUNK_FREE) {
+            Chunk *chunk = &pool.chunks[pool.filled % pool.nchunks];
+            pthread_mutex_unlock(&pool.lock);
+            if (reader.map)
+                map_chunk(&reader, chunk);
+            else
+                read_ok = fill_chunk(&reader, chunk);
+            pthread_mutex_lock(&pool.lock);
+            if (!read_ok)
+                break;
+            chunk->seq = pool.filled++;
+            chunk->state = CHUNK_FILLED;
+            pthread_cond_broadcast(&pool.cond);
         }
-
-        // Asignar campos al struct
-        temp.ID = atoi(fields[0]);
-        strncpy(temp.EAN13, fields[1], sizeof(temp.EAN13)-1);
-        strncpy(temp.product, fields[2], sizeof(temp.product)-1);
-        temp.price = atof(fields[3]);
-        temp.stock = atoi(fields[4]);
-        temp.price01 = atof(fields[5]);
-        temp.price02 = atof(fields[6]);
-        temp.price03 = atof(fields[7]);
-        temp.price04 = atof(fields[8]);
-        strncpy(temp.fabricante, fields[9], sizeof(temp.fabricante)-1);
-        strncpy(temp.proveedor, fields[10], sizeof(temp.proveedor)-1);
-        strncpy(temp.departamento, fields[11], sizeof(temp.departamento)-1);
-        strncpy(temp.clase, fields[12], sizeof(temp.clase)-1);
-        strncpy(temp.subclase, fields[13], sizeof(temp.subclase)-1);
-        strncpy(temp.tipo_IVA, fields[14], sizeof(temp.tipo_IVA)-1);
-        strncpy(temp.descripcion1, fields[15], sizeof(temp.descripcion1)-1);
-        strncpy(temp.descripcion2, fields[16], sizeof(temp.descripcion2)-1);
-        strncpy(temp.descripcion3, fields[17], sizeof(temp.descripcion3)-1);
-        strncpy(temp.descripcion4, fields[18], sizeof(temp.descripcion4)-1);
-
-        // Validar que tipo_IVA sea "reducido" o "super reducido"
-        if (strcasecmp(temp.tipo_IVA, "reducido") != 0 && strcasecmp(temp.tipo_IVA, "super reducido") != 0) {
-            fprintf(stderr, "Tipo de IVA inválido en línea: %s\n", line);
-            continue; // Saltar este registro
+        if (!read_ok || next_write == pool.filled) {
+            pthread_mutex_unlock(&pool.lock);
+            ok = read_ok;
+            break;
         }
 
-        products[count++] = temp;
+        // Escribir el siguiente trozo en orden
+        Chunk *chunk = &pool.chunks[next_write % pool.nchunks];
+        while (chunk->state != CHUNK_PARSED)
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+
+        if (chunk->warnings_len > 0)
+            fwrite(chunk->warnings, 1, chunk->warnings_len, stderr);
+        ok = !chunk->failed && write_batch(writer, chunk->products, chunk->count);
+        next_write++;
+
+        pthread_mutex_lock(&pool.lock);
+        chunk->state = CHUNK_FREE;
+        pthread_mutex_unlock(&pool.lock);
     }
 
-    fclose(f);
+    pthread_mutex_lock(&pool.lock);
+    pool.done = true;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    for (size_t i = 0; i < pool.nchunks; i++) {
+        free(pool.chunks[i].data);
+        free(pool.chunks[i].products);
+        free(pool.chunks[i].warnings);
+    }
+    free(pool.chunks);
+    free(workers);
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+    close_reader(&reader);
+
+    long count = (long)catalog_writer_count(writer);
+    if (ok) ok = catalog_writer_finish(writer);
+    else catalog_writer_abort(writer);
+    if (!ok) {
+        perror(read_ok ? "No se pudo escribir el archivo binario" : "No se pudo leer el archivo CSV");
+        return -1;
+    }
     return count;
 }
 
+/* Ayudantes para componer una fila CSV: devuelven el final de lo escrito. */
+static char *put_text(char *p, const char *text) {
+    size_t len = strlen(text);
+    memcpy(p, text, len);
+    return p + len;
+}
+
+static char *put_quoted(char *p, const char *text) {
+    *p++ = '"';
+    p = put_text(p, text);
+    *p++ = '"';
+    return p;
+}
+
+static char *put_int(char *p, int value) {
+    char tmp[12];
+    char *d = tmp + sizeof(tmp);
+    unsigned v = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+    do {
+        *--d = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0)
+        *--d = '-';
+    size_t len = (size_t)(tmp + sizeof(tmp) - d);
+    memcpy(p, d, len);
+    return p + len;
+}
+
+static char *put_price(char *p, Money price) {
+    return p + money_format(price, p);
+}
+
 /**
- * Guarda en CSV la información de un arreglo de productos, incluyendo los nuevos campos de descripción.
+ * Escribe en CSV un lote de productos, incluyendo los campos de descripción.
+ * Cada fila se compone a mano en un búfer y los precios salen de los
+ * céntimos con money_format(), sin pasar por printf.
  *
- * @param filename  Nombre del archivo CSV a generar
+ * @param f         Archivo CSV abierto para escritura
  * @param products  Arreglo con los productos
  * @param count     Cantidad de productos
  */
-void save_to_csv(const char *filename, Product *products, int count) {
-    FILE *f = fopen(filename, "w");
-    if (!f) {
-        perror("No se pudo abrir el archivo CSV para escribir");
-        return;
-    }
-
-    // Escribir encabezado con los nuevos campos de descripción
-    fprintf(f, "ID,EAN13,product,price,stock,price01,price02,price03,price04,fabricante,proveedor,departamento,clase,subclase,tipo_IVA,descripcion1,descripcion2,descripcion3,descripcion4\n");
-
+static void write_csv_rows(FILE *f, const Product *products, int count) {
+    // Cabe de sobra: los textos de Product suman menos de 1 KB
+    char row[2048];
     for (int i = 0; i < count; i++) {
-        // Función para encerrar campos en comillas y escapar comillas internas
-        #define ESCAPE_AND_QUOTE(field) "\"" , \
-            ({ \
-                char *temp_field = malloc(strlen(products[i].field)*2 + 1); \
-                if (!temp_field) { \
-                    fprintf(stderr, "Error de memoria\n"); \
-                    exit(1); \
-                } \
-                char *src = products[i].field; \
-                char *dst = temp_field; \
-                while (*src) { \
-                    if (*src == '\"') { \
-                        *dst++ = '\"'; \
-                    } \
-                    *dst++ = *src++; \
-                } \
-                *dst = '\0'; \
-                temp_field; \
-            }) , "\"" 
-
-        // Preparar cada campo entrecomillado si es necesario
-        fprintf(f, "%d,%s,%s,%.2f,%d,%.2f,%.2f,%.2f,%.2f,%s,%s,%s,%s,%s,%s,\"%s\",\"%s\",\"%s\",\"%s\"\n",
-                products[i].ID,
-                products[i].EAN13,
-                // Encerrar en comillas y manejar comas dentro
-                products[i].product,
-                products[i].price,
-                products[i].stock,
-                products[i].price01,
-                products[i].price02,
-                products[i].price03,
-                products[i].price04,
-                products[i].fabricante,
-                products[i].proveedor,
-                products[i].departamento,
-                products[i].clase,
-                products[i].subclase,
-                products[i].tipo_IVA,
-                products[i].descripcion1,
-                products[i].descripcion2,
-                products[i].descripcion3,
-                products[i].descripcion4
-        );
-
-        /*
-        // Alternativa con manejo de comillas:
-        // Implementar una función para encerrar en comillas y escapar comillas internas
-        // Para simplificar, aquí se asume que los campos de descripción no contienen comillas
-        fprintf(f, "%d,\"%s\",\"%s\",%.2f,%d,%.2f,%.2f,%.2f,%.2f,\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\"\n",
-                products[i].ID,
-                products[i].EAN13,
-                products[i].product,
-                products[i].price,
-                products[i].stock,
-                products[i].price01,
-                products[i].price02,
-                products[i].price03,
-                products[i].price04,
-                products[i].fabricante,
-                products[i].proveedor,
-                products[i].departamento,
-                products[i].clase,
-                products[i].subclase,
-                products[i].tipo_IVA,
-                products[i].descripcion1,
-                products[i].descripcion2,
-                products[i].descripcion3,
-                products[i].descripcion4
-        );
-        */
+        const Product *prod = &products[i];
+        char *p = row;
+        p = put_int(p, prod->ID);                   *p++ = ',';
+        p = put_text(p, prod->EAN13);               *p++ = ',';
+        p = put_text(p, prod->product);             *p++ = ',';
+        p = put_price(p, prod->price);              *p++ = ',';
+        p = put_int(p, prod->stock);                *p++ = ',';
+        p = put_price(p, prod->price01);            *p++ = ',';
+        p = put_price(p, prod->price02);            *p++ = ',';
+        p = put_price(p, prod->price03);            *p++ = ',';
+        p = put_price(p, prod->price04);            *p++ = ',';
+        p = put_text(p, prod->fabricante);          *p++ = ',';
+        p = put_text(p, prod->proveedor);           *p++ = ',';
+        p = put_text(p, prod->departamento);        *p++ = ',';
+        p = put_text(p, prod->clase);               *p++ = ',';
+        p = put_text(p, prod->subclase);            *p++ = ',';
+        p = put_text(p, prod->tipo_IVA);            *p++ = ',';
+        // Encerrar en comillas y manejar comas dentro
+        p = put_quoted(p, prod->descripcion1);      *p++ = ',';
+        p = put_quoted(p, prod->descripcion2);      *p++ = ',';
+        p = put_quoted(p, prod->descripcion3);      *p++ = ',';
+        p = put_quoted(p, prod->descripcion4);      *p++ = '\n';
+        fwrite(row, 1, (size_t)(p - row), f);
     }
-
-    fclose(f);
 }
 
 /**
- * Lee un archivo binario de productos y los almacena en 'products'.
+ * Exporta a CSV un catálogo binario de lote en lote. Acepta tanto el formato
+ * con cabecera como los volcados antiguos sin ella; los registros borrados
+ * no se exportan.
  *
- * @param filename  Nombre del archivo binario
- * @param products  Arreglo donde se guardan los productos leídos
- * @return          Cantidad de productos leídos
+ * @param bin_file  Nombre del archivo binario
+ * @param csv_file  Nombre del archivo CSV a generar
+ * @return          Cantidad de registros exportados, o -1 si hubo un error
  */
-int load_from_binary(const char *filename, Product *products) {
-    FILE *f = fopen(filename, "rb");
-    if (!f) {
-        perror("No se pudo abrir el archivo binario para lectura");
+long binary_to_csv(const char *bin_file, const char *csv_file) {
+    Catalog cat;
+    if (!catalog_open_readonly(&cat, bin_file)) {
+        fprintf(stderr, "No se pudo abrir el archivo binario para lectura: %s\n", cat.error);
         return -1;
     }
+    FILE *f = fopen(csv_file, "w");
+    Product *batch = malloc(BATCH_ROWS * sizeof(Product));
+    if (!f || !batch) {
+        perror("No se pudo abrir el archivo CSV para escribir");
+        if (f) fclose(f);
+        free(batch);
+        catalog_close(&cat);
+        return -1;
+    }
+
+    // Escribir encabezado con los campos de descripción
+    fprintf(f, "ID,EAN13,product,price,stock,price01,price02,price03,price04,fabricante,proveedor,departamento,clase,subclase,tipo_IVA,descripcion1,descripcion2,descripcion3,descripcion4\n");
 
-    // Leemos hasta MAX_PRODUCTS
-    int count = 0;
-    while (!feof(f) && count < MAX_PRODUCTS) {
-        size_t readCount = fread(&products[count], sizeof(Product), 1, f);
-        if (readCount == 1) {
-            count++;
+    long count = 0;
+    int pending = 0;
+    size_t total = catalog_count(&cat);
+    for (size_t pos = 0; pos < total; pos++) {
+        if (!catalog_get(&cat, pos, &batch[pending]))
+            continue;
+        if (++pending == BATCH_ROWS) {
+            write_csv_rows(f, batch, pending);
+            count += pending;
+            pending = 0;
         }
     }
+    write_csv_rows(f, batch, pending);
+    count += pending;
 
-    fclose(f);
+    free(batch);
+    catalog_close(&cat);
+    if (fclose(f) != 0) {
+        perror("No se pudo escribir el archivo CSV");
+        return -1;
+    }
     return count;
 }
 
-/**
- * Guarda un arreglo de 'count' productos en un archivo binario.
- *
- * @param filename  Nombre del archivo binario
- * @param products  Arreglo de productos
- * @param count     Cantidad de productos a guardar
- */
-void save_to_binary(const char *filename, Product *products, int count) {
-    FILE *f = fopen(filename, "wb");
-    if (!f) {
-        perror("No se pudo abrir el archivo binario para escribir");
-        return;
-    }
-
-    // Escribimos uno a uno los productos
-    fwrite(products, sizeof(Product), count, f);
-    fclose(f);
+static double elapsed_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
 }
 
 /**
@@ -304,12 +589,14 @@ void save_to_binary(const char *filename, Product *products, int count) {
  * convierte archivos CSV a binario o binario a CSV.
  *
  * Uso:
- *   ./product_converter csv2bin <archivoCSV> <archivoBin>
+ *   ./product_converter csv2bin <archivoCSV> <archivoBin> [hilos]
  *   ./product_converter bin2csv <archivoBin> <archivoCSV>
+ *
+ * Sin [hilos], csv2bin usa un hilo por procesador en línea.
  */
 int main(int argc, char **argv) {
     if (argc < 4) {
-        fprintf(stderr, "Uso: %s [csv2bin|bin2csv] <archivoEntrada> <archivoSalida>\n", argv[0]);
+        fprintf(stderr, "Uso: %s [csv2bin|bin2csv] <archivoEntrada> <archivoSalida> [hilos]\n", argv[0]);
         return 1;
     }
 
@@ -317,27 +604,40 @@ int main(int argc, char **argv) {
     const char *inputFile = argv[2];
     const char *outputFile = argv[3];
 
-    Product products[MAX_PRODUCTS];
-    int count;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 4) {
+        char *rest;
+        threads = strtol(argv[4], &rest, 10);
+        if (*rest != '\0' || threads < 1 || threads > MAX_THREADS) {
+            fprintf(stderr, "Número de hilos inválido: %s (1-%d)\n", argv[4], MAX_THREADS);
+            return 1;
+        }
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long count;
+    const char *done;
 
     if (strcmp(mode, "csv2bin") == 0) {
         // Leer CSV, guardar bin
-        count = load_from_csv(inputFile, products);
-        if (count >= 0) {
-            save_to_binary(outputFile, products, count);
-            printf("Convertido CSV a binario: %d registros.\n", count);
-        }
+        count = csv_to_binary(inputFile, outputFile, (int)threads);
+        done = "Convertido CSV a binario";
     } else if (strcmp(mode, "bin2csv") == 0) {
         // Leer bin, guardar CSV
-        count = load_from_binary(inputFile, products);
-        if (count >= 0) {
-            save_to_csv(outputFile, products, count);
-            printf("Convertido binario a CSV: %d registros.\n", count);
-        }
+        count = binary_to_csv(inputFile, outputFile);
+        done = "Convertido binario a CSV";
     } else {
         fprintf(stderr, "Modo no reconocido. Use 'csv2bin' o 'bin2csv'.\n");
         return 1;
     }
+    if (count < 0)
+        return 1;
 
+    double seconds = elapsed_since(&start);
+    printf("%s: %ld registros en %.2f s (%.0f registros/s).\n",
+           done, count, seconds, seconds > 0 ? (double)count / seconds : 0.0);
     return 0;
 }
@@ -0,0 +1,346 @@
+/*
+  Acumulados de ventas para los informes X y Z, con punto de control en
+  disco para no releer el diario.
+*/
+
+#include "report.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#define fdatasync fsync
+#endif
+
+#define CRC_START offsetof(ReportTotals, journal_segment)
+
+_Static_assert(sizeof(ReportRow) == 72, "ReportRow forma parte del formato");
+
+// ---------------------------------------------------------------------------
+// Acumulados
+// ---------------------------------------------------------------------------
+/* Suma a la fila de 'key'; si la sección está llena, a la fila "(other)". */
+static void add_row(ReportSection *s, const char *key, size_t len, int64_t count, Money amount) {
+    if (len == 0) {
+        key = "(none)";
+        len = strlen(key);
+    }
+    if (len >= REPORT_KEY_SIZE)
+        len = REPORT_KEY_SIZE - 1;
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t i = 0; i < s->count; i++) {
+            ReportRow *row = &s->rows[i];
+            if (strncmp(row->key, key, len) == 0 && row->key[len] == '\0') {
+                row->count += count;
+                row->amount += amount;
+                return;
+            }
+        }
+        // La última fila se reserva para lo que no cabe.
+        if (s->count < REPORT_MAX_ROWS - 1 || (pass == 1 && s->count < REPORT_MAX_ROWS)) {
+            ReportRow *row = &s->rows[s->count++];
+            memset(row, 0, sizeof(*row));
+            memcpy(row->key, key, len);
+            row->count = count;
+            row->amount = amount;
+            return;
+        }
+        key = "(other)";
+        len = strlen(key);
+    }
+}
+
+/* Valor del diccionario del catálogo para el producto, o "(unknown)" si ya no existe. */
+static size_t product_dict_value(Catalog *cat, int id, CatalogDictColumn column, char *out, size_t size) {
+    HotProduct hot;
+    if (!catalog_find_hot(cat, id, &hot) || !catalog_dict_value(cat, column, hot.dict[column], out, size))
+        snprintf(out, size, "(unknown)");
+    return strlen(out);
+}
+
+static void aggregate(SalesReport *rep, const TicketHeader *t, uint64_t segment, int64_t created,
+                      uint64_t end) {
+    ReportTotals *tot = &rep->totals;
+    tot->tickets++;
+    tot->total += t->total;
+    add_row(&tot->sections[REPORT_AGENT], t->agent, strnlen(t->agent, sizeof(t->agent)), 1, t->total);
+
+    char key[REPORT_KEY_SIZE];
+    time_t when = (time_t)t->timestamp;
+    struct tm tm;
+    int len = localtime_r(&when, &tm) ? snprintf(key, sizeof(key), "%02d:00", tm.tm_hour) : 0;
+    add_row(&tot->sections[REPORT_HOUR], key, (size_t)len, 1, t->total);
+
+    const TicketLine *lines = ticket_lines(t);
+    for (uint32_t i = 0; i < t->line_count; i++) {
+        Money amount = lines[i].unit_price * lines[i].qty;
+        if (rep->catalog) {
+            size_t n = product_dict_value(rep->catalog, lines[i].ID, DICT_DEPARTAMENTO, key, sizeof(key));
+            add_row(&tot->sections[REPORT_DEPARTMENT], key, n, lines[i].qty, amount);
+            n = product_dict_value(rep->catalog, lines[i].ID, DICT_TIPO_IVA, key, sizeof(key));
+            add_row(&tot->sections[REPORT_VAT], key, n, lines[i].qty, amount);
+        }
+    }
+
+    len = t->payment == PAYMENT_CASH ? snprintf(key, sizeof(key), "Cash")
+                                     : snprintf(key, sizeof(key), "Other (%u)", t->payment);
+    add_row(&tot->sections[REPORT_PAYMENT], key, (size_t)len, 1, t->total);
+    tot->journal_segment = segment;
+    tot->journal_created = created;
+    tot->journal_offset = end;
+}
+
+// ---------------------------------------------------------------------------
+// Punto de control
+// ---------------------------------------------------------------------------
+static uint32_t totals_crc(const ReportTotals *tot) {
+    return crc32c(0, (const char *)tot + CRC_START, sizeof(*tot) - CRC_START);
+}
+
+/* Escribe el punto de control con fdatasync() y rename(); llamar con el cerrojo. */
+static bool save_locked(SalesReport *rep) {
+    rep->totals.crc = totals_crc(&rep->totals);
+    size_t len = strlen(rep->filename);
+    char *tmp = malloc(len + 5);
+    if (!tmp) {
+        snprintf(rep->error, sizeof(rep->error), "out of memory");
+        return false;
+    }
+    memcpy(tmp, rep->filename, len);
+    memcpy(tmp + len, ".tmp", 5);
+    FILE *file = fopen(tmp, "wb");
+    bool ok = file != NULL;
+    if (ok) {
+        ok = fwrite(&rep->totals, sizeof(rep->totals), 1, file) == 1;
+        ok = fflush(file) == 0 && fdatasync(fileno(file)) == 0 && ok;
+        ok = fclose(file) == 0 && ok;
+    }
+    ok = ok && rename(tmp, rep->filename) == 0;
+    if (!ok) remove(tmp);
+    free(tmp);
+    if (!ok)
+        snprintf(rep->error, sizeof(rep->error), "cannot write report checkpoint '%s'", rep->filename);
+    else
+        rep->pending = 0;
+    return ok;
+}
+
+/* Acumulados vacíos de un periodo que empieza en 'start'. */
+static void reset_totals(ReportTotals *tot, int64_t start) {
+    uint64_t segment = tot->journal_segment;
+    int64_t created = tot->journal_created;
+    uint64_t offset = tot->journal_offset;
+    uint64_t z_number = tot->z_number;
+    memset(tot, 0, sizeof(*tot));
+    memcpy(tot->magic, REPORT_MAGIC, sizeof(tot->magic));
+    tot->version = REPORT_VERSION;
+    tot->journal_segment = segment;
+    tot->journal_created = created;
+    tot->journal_offset = offset;
+    tot->z_number = z_number;
+    tot->period_start = start;
+}
+
+static bool read_checkpoint(SalesReport *rep) {
+    FILE *file = fopen(rep->filename, "rb");
+    if (!file)
+        return false;
+    ReportTotals *tot = &rep->totals;
+    bool ok = fread(tot, sizeof(*tot), 1, file) == 1;
+    fclose(file);
+    return ok && memcmp(tot->magic, REPORT_MAGIC, sizeof(tot->magic)) == 0 &&
+           tot->version == REPORT_VERSION && tot->crc == totals_crc(tot);
+}
+
+/* El punto de control vale si 'r' es su segmento y apunta a un ticket suyo (o a su final). */
+static bool checkpoint_matches(const ReportTotals *tot, JournalReader *r) {
+    if (!r->map || r->segment != tot->journal_segment || r->created != tot->journal_created ||
+        tot->journal_offset < r->start || tot->journal_offset > r->size)
+        return false;
+    if (tot->journal_offset == r->size)
+        return true;
+    journal_seek(r, tot->journal_offset);
+    return journal_next(r) != NULL;
+}
+
+/**
+ * Carga los acumulados y les suma los tickets del diario que el punto de
+ * control aún no tenía, del segmento donde se quedó en adelante. Sin punto
+ * de control válido se rehacen con todos los segmentos como un solo
+ * periodo (y se avisa en rep->error).
+ *
+ * @param catalog  Para departamento e IVA; NULL para no agregarlos
+ * @return         false si no se pudo leer el diario o guardar el punto de
+ *                 control; entonces el punto de control en disco no cambia
+ */
+bool report_open(SalesReport *rep, const char *filename, Catalog *catalog, const char *journal_filename) {
+    memset(rep, 0, sizeof(*rep));
+    pthread_mutex_init(&rep->lock, NULL);
+    rep->catalog = catalog;
+    rep->filename = strdup(filename);
+    JournalSegments segments;
+    if (!rep->filename || !journal_segments_open(&segments, journal_filename)) {
+        snprintf(rep->error, sizeof(rep->error), "%s", rep->filename ? segments.error : "out of memory");
+        return false;
+    }
+    size_t first = segments.count;
+    if (read_checkpoint(rep)) {
+        for (size_t i = 0; i < segments.count && first == segments.count; i++)
+            if (segments.items[i].segment == rep->totals.journal_segment)
+                first = i;
+    }
+    JournalReader r;
+    bool resume = false;
+    if (first < segments.count) {
+        resume = journal_reader_open(&r, segments.items[first].filename) && checkpoint_matches(&rep->totals, &r);
+        journal_reader_close(&r);
+    }
+    if (!resume) {
+        if (access(filename, F_OK) == 0)
+            snprintf(rep->error, sizeof(rep->error), "report checkpoint did not match the journal; rebuilt");
+        memset(&rep->totals, 0, sizeof(rep->totals));
+        rep->totals.z_number = 1;
+        reset_totals(&rep->totals, 0);
+        rep->pending = 1;
+        first = 0;
+    }
+    bool ok = true;
+    for (size_t i = first; i < segments.count; i++) {
+        if (!journal_reader_open(&r, segments.items[i].filename)) {
+            snprintf(rep->error, sizeof(rep->error), "cannot read journal segment '%s'", segments.items[i].filename);
+            ok = false;
+            break;
+        }
+        if (resume && i == first)
+            journal_seek(&r, rep->totals.journal_offset);
+        const TicketHeader *t;
+        while ((t = journal_next(&r)) != NULL) {
+            aggregate(rep, t, r.segment, r.created, r.pos);
+            rep->pending++;
+        }
+        journal_reader_close(&r);
+    }
+    journal_segments_close(&segments);
+    if (!ok) {
+        // Un punto de control más allá del segmento perdería sus tickets.
+        rep->pending = 0;
+        return false;
+    }
+    return rep->pending == 0 || save_locked(rep);
+}
+
+/* Suma un ticket ya en disco. 'end' es el final de su registro en el segmento. */
+void report_add(SalesReport *rep, const TicketHeader *ticket, uint64_t segment, int64_t created,
+                uint64_t end) {
+    pthread_mutex_lock(&rep->lock);
+    aggregate(rep, ticket, segment, created, end);
+    if (++rep->pending >= REPORT_CHECKPOINT_TICKETS)
+        save_locked(rep);
+    pthread_mutex_unlock(&rep->lock);
+}
+
+/* Copia de los acumulados del periodo en curso, para un X. */
+void report_snapshot(SalesReport *rep, ReportTotals *out) {
+    pthread_mutex_lock(&rep->lock);
+    *out = rep->totals;
+    pthread_mutex_unlock(&rep->lock);
+}
+
+/**
+ * Cierra el periodo (Z): devuelve sus acumulados y empieza otro a cero.
+ *
+ * @return  false si no se pudo guardar; entonces el periodo sigue abierto
+ */
+bool report_close_period(SalesReport *rep, ReportTotals *closed) {
+    pthread_mutex_lock(&rep->lock);
+    *closed = rep->totals;
+    rep->totals.z_number++;
+    reset_totals(&rep->totals, (int64_t)time(NULL));
+    bool ok = save_locked(rep);
+    if (!ok)
+        rep->totals = *closed;
+    pthread_mutex_unlock(&rep->lock);
+    return ok;
+}
+
+bool report_save(SalesReport *rep) {
+    pthread_mutex_lock(&rep->lock);
+    bool ok = save_locked(rep);
+    pthread_mutex_unlock(&rep->lock);
+    return ok;
+}
+
+void report_close(SalesReport *rep) {
+    if (rep->filename && rep->pending > 0)
+        save_locked(rep);
+    free(rep->filename);
+    rep->filename = NULL;
+    pthread_mutex_destroy(&rep->lock);
+}
+
+// ---------------------------------------------------------------------------
+// Texto
+// ---------------------------------------------------------------------------
+static int compare_keys(const void *a, const void *b) {
+    return strcmp(((const ReportRow *)a)->key, ((const ReportRow *)b)->key);
+}
+
+static void format_date(int64_t when, char *buf, size_t size) {
+    time_t t = (time_t)when;
+    struct tm tm;
+    if (!localtime_r(&t, &tm) || !strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm))
+        snprintf(buf, size, "?");
+}
+
+static void section_text(const ReportSection *s, const char *title, const char *count_label,
+                         bool sorted, ReportLineFn emit, void *ctx) {
+    char line[TICKET_TEXT_SIZE];
+    char amount[MONEY_BUFSIZE];
+    ReportRow rows[REPORT_MAX_ROWS];
+    uint32_t count = s->count < REPORT_MAX_ROWS ? s->count : REPORT_MAX_ROWS;
+    memcpy(rows, s->rows, count * sizeof(ReportRow));
+    if (sorted)
+        qsort(rows, count, sizeof(ReportRow), compare_keys);
+    emit("", ctx);
+    snprintf(line, sizeof(line), "%-30s %10s %14s", title, count_label, "Amount");
+    emit(line, ctx);
+    for (uint32_t i = 0; i < count; i++) {
+        money_format(rows[i].amount, amount);
+        snprintf(line, sizeof(line), "  %-28.28s %10lld %14s", rows[i].key, (long long)rows[i].count, amount);
+        emit(line, ctx);
+    }
+}
+
+/**
+ * Texto de un informe X (periodo en curso) o Z (periodo cerrado).
+ *
+ * @param emit  Recibe cada línea, sin salto de línea final
+ */
+void report_text(const ReportTotals *totals, bool z, ReportLineFn emit, void *ctx) {
+    char line[TICKET_TEXT_SIZE];
+    char from[24], to[24], amount[MONEY_BUFSIZE];
+    if (z)
+        snprintf(line, sizeof(line), "Z REPORT #%llu", (unsigned long long)totals->z_number);
+    else
+        snprintf(line, sizeof(line), "X REPORT (period #%llu, not closed)", (unsigned long long)totals->z_number);
+    emit(line, ctx);
+    if (totals->period_start > 0)
+        format_date(totals->period_start, from, sizeof(from));
+    else
+        snprintf(from, sizeof(from), "beginning");
+    format_date((int64_t)time(NULL), to, sizeof(to));
+    snprintf(line, sizeof(line), "Period: %s - %s", from, to);
+    emit(line, ctx);
+    money_format(totals->total, amount);
+    snprintf(line, sizeof(line), "Tickets: %llu   Total: %s", (unsigned long long)totals->tickets, amount);
+    emit(line, ctx);
+
+    section_text(&totals->sections[REPORT_AGENT], "By agent", "Tickets", false, emit, ctx);
+    section_text(&totals->sections[REPORT_HOUR], "By hour", "Tickets", true, emit, ctx);
+    section_text(&totals->sections[REPORT_DEPARTMENT], "By department", "Units", false, emit, ctx);
+    section_text(&totals->sections[REPORT_VAT], "By VAT class", "Units", false, emit, ctx);
+    section_text(&totals->sections[REPORT_PAYMENT], "By payment", "Tickets", false, emit, ctx);
+}
@@ -0,0 +1,97 @@
+/*
+  Informes X y Z.
+
+  Los acumulados del periodo (desde el último Z) se actualizan con cada
+  ticket en cuanto está en disco: totales por agente, por hora, por
+  departamento, por tipo de IVA y por medio de pago. Así un X o un Z se
+  imprime al momento, sin releer el diario.
+
+  Los acumulados se guardan en un punto de control junto con la posición
+  del diario (segmento y desplazamiento) hasta la que llegan; al arrancar
+  se carga y solo se agregan los tickets posteriores. El punto de control se escribe cada
+  REPORT_CHECKPOINT_TICKETS tickets, al salir y en cada Z (que además
+  pone a cero el periodo), siempre con fdatasync() y rename().
+
+  Departamento e IVA se toman del catálogo por el ID del producto al
+  agregar cada línea.
+
+  Formato del punto de control (versión 2): un ReportTotals tal cual, con
+  un CRC-32C de todo lo que sigue al campo crc.
+*/
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "catalog.h"
+#include "journal.h"
+#include "money.h"
+
+#define REPORT_MAGIC              "POSREPT\n"
+#define REPORT_VERSION            2
+#define REPORT_KEY_SIZE           52
+#define REPORT_MAX_ROWS           64   // Filas por sección; las que no caben van a "(other)"
+#define REPORT_CHECKPOINT_TICKETS 256
+
+typedef struct {
+    char      key[REPORT_KEY_SIZE];
+    uint32_t  reserved;
+    int64_t   count;              // Tickets, o unidades en departamento e IVA
+    Money     amount;
+} ReportRow;
+
+typedef struct {
+    uint32_t  count;
+    uint32_t  reserved;
+    ReportRow rows[REPORT_MAX_ROWS];
+} ReportSection;
+
+typedef enum {
+    REPORT_AGENT,
+    REPORT_HOUR,
+    REPORT_DEPARTMENT,
+    REPORT_VAT,
+    REPORT_PAYMENT,
+    REPORT_SECTIONS
+} ReportSectionId;
+
+typedef struct {
+    char          magic[8];
+    uint32_t      version;
+    uint32_t      crc;            // CRC-32C de lo que sigue
+    uint64_t      journal_segment;
+    int64_t       journal_created; // Del segmento
+    uint64_t      journal_offset; // Segmento agregado hasta aquí
+    uint64_t      z_number;       // Z que cerrará este periodo
+    int64_t       period_start;   // Fecha del último Z (0 = desde el principio)
+    uint64_t      tickets;
+    Money         total;
+    ReportSection sections[REPORT_SECTIONS];
+} ReportTotals;
+
+typedef struct {
+    char           *filename;
+    Catalog        *catalog;
+    pthread_mutex_t lock;         // El escritor agrega mientras la caja consulta
+    ReportTotals    totals;
+    unsigned        pending;      // Tickets agregados desde el último punto de control
+    char            error[128];
+} SalesReport;
+
+bool report_open(SalesReport *rep, const char *filename, Catalog *catalog, const char *journal_filename);
+void report_add(SalesReport *rep, const TicketHeader *ticket, uint64_t segment, int64_t created,
+                uint64_t end);
+void report_snapshot(SalesReport *rep, ReportTotals *out);
+bool report_close_period(SalesReport *rep, ReportTotals *closed);
+bool report_save(SalesReport *rep);
+void report_close(SalesReport *rep);
+
+// Texto del informe, una línea cada vez.
+typedef void (*ReportLineFn)(const char *line, void *ctx);
+
+void report_text(const ReportTotals *totals, bool z, ReportLineFn emit, void *ctx);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+  Descuento de existencias desde el diario de tickets, con punto de control
+  para que al arrancar solo se vuelva a aplicar la cola.
+*/
+
+#include "stock_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#define fdatasync fsync
+#endif
+
+#define CRC_START   offsetof(StockCheckpoint, journal_segment)
+#define DELTA_STACK 64        // Líneas de un ticket normal, sin malloc
+
+_Static_assert(sizeof(StockCheckpoint) == 48, "StockCheckpoint forma parte del formato");
+
+// ---------------------------------------------------------------------------
+// Aplicación
+// ---------------------------------------------------------------------------
+static int compare_deltas(const void *a, const void *b) {
+    int x = ((const StockDelta *)a)->ID, y = ((const StockDelta *)b)->ID;
+    return x < y ? -1 : x > y;
+}
+
+/* Descuenta las líneas de un ticket en disco; 'end' es el final de su registro. */
+static void apply_ticket(StockLog *log, const TicketHeader *t, uint64_t segment, int64_t created,
+                         uint64_t end) {
+    StockDelta stack[DELTA_STACK];
+    StockDelta *deltas = t->line_count <= DELTA_STACK ? stack : malloc(t->line_count * sizeof(StockDelta));
+    if (t->line_count == 0) {
+        // Nada que descontar; solo avanza el punto de control.
+    } else if (!deltas) {
+        snprintf(log->error, sizeof(log->error), "out of memory; stock of ticket %llu not updated",
+                 (unsigned long long)t->ticket_id);
+    } else {
+        const TicketLine *lines = ticket_lines(t);
+        for (uint32_t i = 0; i < t->line_count; i++) {
+            deltas[i].ID = lines[i].ID;
+            deltas[i].qty = lines[i].qty;
+        }
+        // Un producto repetido en varias líneas es una sola variación.
+        if (t->line_count > 1)
+            qsort(deltas, t->line_count, sizeof(StockDelta), compare_deltas);
+        size_t count = 0;
+        for (uint32_t i = 0; i < t->line_count; i++) {
+            if (count > 0 && deltas[count - 1].ID == deltas[i].ID)
+                deltas[count - 1].qty += deltas[i].qty;
+            else
+                deltas[count++] = deltas[i];
+        }
+        if (!catalog_apply_stock(log->catalog, t->ticket_id, deltas, count))
+            snprintf(log->error, sizeof(log->error), "stock of ticket %llu not fully updated",
+                     (unsigned long long)t->ticket_id);
+        if (deltas != stack)
+            free(deltas);
+    }
+    StockCheckpoint *cp = &log->checkpoint;
+    cp->journal_segment = segment;
+    cp->journal_created = created;
+    cp->journal_offset = end;
+    cp->last_ticket = t->ticket_id;
+    log->pending++;
+}
+
+// ---------------------------------------------------------------------------
+// Punto de control
+// ---------------------------------------------------------------------------
+static uint32_t checkpoint_crc(const StockCheckpoint *cp) {
+    return crc32c(0, (const char *)cp + CRC_START, sizeof(*cp) - CRC_START);
+}
+
+/*
+  Lleva products.dat al disco y después apunta hasta dónde llega, con
+  fdatasync() y rename(). En ese orden: el punto de control nunca cubre
+  existencias que no están en disco.
+*/
+static bool save(StockLog *log) {
+    if (!catalog_sync(log->catalog)) {
+        snprintf(log->error, sizeof(log->error), "cannot sync stock to disk");
+        return false;
+    }
+    StockCheckpoint *cp = &log->checkpoint;
+    memcpy(cp->magic, STOCK_MAGIC, sizeof(cp->magic));
+    cp->version = STOCK_VERSION;
+    cp->crc = checkpoint_crc(cp);
+    size_t len = strlen(log->filename);
+    char *tmp = malloc(len + 5);
+    if (!tmp) {
+        snprintf(log->error, sizeof(log->error), "out of memory");
+        return false;
+    }
+    memcpy(tmp, log->filename, len);
+    memcpy(tmp + len, ".tmp", 5);
+    FILE *file = fopen(tmp, "wb");
+    bool ok = file != NULL;
+    if (ok) {
+        ok = fwrite(cp, sizeof(*cp), 1, file) == 1;
+        ok = fflush(file) == 0 && fdatasync(fileno(file)) == 0 && ok;
+        ok = fclose(file) == 0 && ok;
+    }
+    ok = ok && rename(tmp, log->filename) == 0;
+    if (!ok) remove(tmp);
+    free(tmp);
+    if (!ok)
+        snprintf(log->error, sizeof(log->error), "cannot write stock checkpoint '%s'", log->filename);
+    else
+        log->pending = 0;
+    return ok;
+}
+
+static bool read_checkpoint(StockLog *log) {
+    FILE *file = fopen(log->filename, "rb");
+    if (!file)
+        return false;
+    StockCheckpoint *cp = &log->checkpoint;
+    bool ok = fread(cp, sizeof(*cp), 1, file) == 1;
+    fclose(file);
+    return ok && memcmp(cp->magic, STOCK_MAGIC, sizeof(cp->magic)) == 0 &&
+           cp->version == STOCK_VERSION && cp->crc == checkpoint_crc(cp);
+}
+
+/* El punto de control vale si 'r' es su segmento y apunta a un ticket suyo (o a su final). */
+static bool checkpoint_matches(const StockCheckpoint *cp, JournalReader *r) {
+    if (!r->map || r->segment != cp->journal_segment || r->created != cp->journal_created ||
+        cp->journal_offset < r->start || cp->journal_offset > r->size)
+        return false;
+    if (cp->journal_offset == r->size)
+        return true;
+    journal_seek(r, cp->journal_offset);
+    return journal_next(r) != NULL;
+}
+
+/**
+ * Vuelve a aplicar a products.dat los tickets del diario posteriores al
+ * punto de control, del segmento donde se quedó en adelante, y guarda uno
+ * nuevo. Sin punto de control válido no se sabe qué tickets descontó ya el
+ * catálogo: se empieza en el final del diario sin reaplicar nada (y se
+ * avisa en log->error si había uno).
+ *
+ * Debe llamarse tras journal_open(), que recorta el final incompleto, y
+ * antes de registrar ventas nuevas; si falla no se debe vender, porque las
+ * existencias de esas ventas no se descontarían.
+ *
+ * @return  false si no se pudo leer el diario o guardar el punto de control;
+ *          entonces el punto de control en disco no cambia
+ */
+bool stock_log_open(StockLog *log, const char *filename, Catalog *catalog, const char *journal_filename) {
+    memset(log, 0, sizeof(*log));
+    log->catalog = catalog;
+    log->filename = strdup(filename);
+    JournalSegments segments;
+    if (!log->filename || !journal_segments_open(&segments, journal_filename)) {
+        snprintf(log->error, sizeof(log->error), "%s", log->filename ? segments.error : "out of memory");
+        return false;
+    }
+    size_t first = segments.count;
+    if (read_checkpoint(log)) {
+        for (size_t i = 0; i < segments.count && first == segments.count; i++)
+            if (segments.items[i].segment == log->checkpoint.journal_segment)
+                first = i;
+    }
+    JournalReader r;
+    bool resume = false;
+    if (first < segments.count) {
+        resume = journal_reader_open(&r, segments.items[first].filename) &&
+                 checkpoint_matches(&log->checkpoint, &r);
+        journal_reader_close(&r);
+    }
+    bool ok = true;
+    if (!resume) {
+        if (access(filename, F_OK) == 0)
+            snprintf(log->error, sizeof(log->error), "stock checkpoint did not match the journal; not replayed");
+        // El segmento activo es el último.
+        memset(&log->checkpoint, 0, sizeof(log->checkpoint));
+        ok = segments.count > 0 && journal_reader_open(&r, segments.items[segments.count - 1].filename);
+        if (ok) {
+            log->checkpoint.journal_segment = r.segment;
+            log->checkpoint.journal_created = r.created;
+            log->checkpoint.journal_offset = r.size;
+            journal_reader_close(&r);
+        } else {
+            snprintf(log->error, sizeof(log->error), "cannot read journal '%s'", journal_filename);
+        }
+        log->pending = 1;
+        first = segments.count;
+    }
+    for (size_t i = first; i < segments.count; i++) {
+        if (!journal_reader_open(&r, segments.items[i].filename)) {
+            snprintf(log->error, sizeof(log->error), "cannot read journal segment '%s'", segments.items[i].filename);
+            ok = false;
+            break;
+        }
+        if (i == first)
+            journal_seek(&r, log->checkpoint.journal_offset);
+        const TicketHeader *t;
+        while ((t = journal_next(&r)) != NULL)
+            apply_ticket(log, t, r.segment, r.created, r.pos);
+        journal_reader_close(&r);
+    }
+    journal_segments_close(&segments);
+    if (!ok) {
+        // El punto de control se queda donde estaba: el próximo arranque
+        // vuelve a aplicar lo que no se pudo leer ahora.
+        log->pending = 0;
+        return false;
+    }
+    return log->pending == 0 || save(log);
+}
+
+/* Descuenta un ticket ya en disco. 'end' es el final de su registro en el segmento. */
+void stock_log_add(StockLog *log, const TicketHeader *ticket, uint64_t segment, int64_t created,
+                   uint64_t end) {
+    apply_ticket(log, ticket, segment, created, end);
+    if (log->pending >= STOCK_CHECKPOINT_TICKETS)
+        save(log);
+}
+
+void stock_log_close(StockLog *log) {
+    if (log->filename && log->pending > 0)
+        save(log);
+    free(log->filename);
+    log->filename = NULL;
+}
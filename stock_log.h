@@ -0,0 +1,61 @@
+/*
+  Existencias de products.dat con el diario de tickets como registro de
+  rehacer.
+
+  Una venta descuenta existencias y registra su ticket como una sola
+  unidad. El registro del ticket, con el ID y las unidades de cada línea, es
+  a la vez el registro de rehacer de sus existencias: el ticket queda
+  confirmado cuando su registro está en disco, y solo entonces el hilo
+  escritor descuenta las existencias. Así products.dat nunca va por delante
+  del diario, y una venta que no llegó al disco no ha tocado el catálogo.
+
+  Cada registro caliente guarda el último ticket que le descontó
+  (stock_ticket); catalog_apply_stock() se salta los productos que ya lo
+  tienen, así que volver a aplicar un ticket no hace nada.
+
+  products.dat no se sincroniza por venta. Cada STOCK_CHECKPOINT_TICKETS
+  tickets se sincroniza y después se guarda en un punto de control hasta
+  qué posición del diario (segmento y desplazamiento) están ya en disco
+  sus existencias. Al arrancar se vuelven a aplicar los tickets que siguen,
+  que tras un corte pueden haberse quedado sin aplicar o a medias.
+
+  Formato del punto de control (versión 1): un StockCheckpoint tal cual,
+  con un CRC-32C de todo lo que sigue al campo crc.
+*/
+#ifndef STOCK_LOG_H
+#define STOCK_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "catalog.h"
+#include "journal.h"
+
+#define STOCK_MAGIC              "POSSTCK\n"
+#define STOCK_VERSION            1
+#define STOCK_CHECKPOINT_TICKETS 256
+
+typedef struct {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  crc;            // CRC-32C de lo que sigue
+    uint64_t  journal_segment;
+    int64_t   journal_created; // Del segmento
+    uint64_t  journal_offset; // Existencias en disco hasta aquí
+    uint64_t  last_ticket;    // Último ticket aplicado
+} StockCheckpoint;
+
+typedef struct {
+    char           *filename;
+    Catalog        *catalog;
+    StockCheckpoint checkpoint;
+    unsigned        pending;      // Tickets aplicados desde el último punto de control
+    char            error[128];
+} StockLog;
+
+bool stock_log_open(StockLog *log, const char *filename, Catalog *catalog, const char *journal_filename);
+void stock_log_add(StockLog *log, const TicketHeader *ticket, uint64_t segment, int64_t created,
+                   uint64_t end);
+void stock_log_close(StockLog *log);
+
+#endif
@@ -0,0 +1,291 @@
+/*
+  Índice disperso por bloques de tickets: búsqueda binaria por ID y por
+  fecha, y filtros de Bloom para saltar bloques sin un agente.
+*/
+
+#include "ticket_index.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ---------------------------------------------------------------------------
+// Filtro de Bloom de agentes
+// ---------------------------------------------------------------------------
+/* Tres bits de 64 elegidos con FNV-1a sobre el código del agente. */
+uint64_t ticket_index_agent_bloom(const char *agent, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len && agent[i]; i++) {
+        h ^= (unsigned char)agent[i];
+        h *= 0x100000001b3ULL;
+    }
+    return (1ULL << (h & 63)) | (1ULL << ((h >> 6) & 63)) | (1ULL << ((h >> 12) & 63));
+}
+
+static inline uint64_t ticket_bloom(const TicketHeader *t) {
+    return ticket_index_agent_bloom(t->agent, sizeof(t->agent));
+}
+
+// ---------------------------------------------------------------------------
+// Mantenimiento
+// ---------------------------------------------------------------------------
+static void write_header(TicketIndex *idx) {
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TICKET_INDEX_MAGIC, sizeof(header.magic));
+    header.version = TICKET_INDEX_VERSION;
+    header.block = TICKET_INDEX_BLOCK;
+    header.journal_created = idx->journal_created;
+    if (ftruncate(idx->fd, 0) != 0 || pwrite(idx->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        // Sin fichero el índice sigue valiendo en memoria.
+        close(idx->fd);
+        idx->fd = -1;
+    }
+}
+
+/* Sin memoria para crecer el índice se abandona: las búsquedas recorren el diario. */
+static void drop_entries(TicketIndex *idx) {
+    free(idx->entries);
+    idx->entries = NULL;
+    idx->count = 0;
+    idx->capacity = 0;
+    idx->open_block = 0;
+    idx->failed = true;
+}
+
+/**
+ * Añade un ticket recién escrito al índice. Al completar un bloque escribe
+ * su entrada en el fichero, si lo hay.
+ *
+ * @param offset  Posición del registro en el diario
+ */
+void ticket_index_add(TicketIndex *idx, const TicketHeader *t, uint64_t offset) {
+    if (idx->failed)
+        return;
+    if (idx->open_block == 0) {
+        if (idx->count == idx->capacity) {
+            size_t capacity = idx->capacity ? idx->capacity * 2 : 64;
+            IndexEntry *grown = realloc(idx->entries, capacity * sizeof(IndexEntry));
+            if (!grown) {
+                drop_entries(idx);
+                return;
+            }
+            idx->entries = grown;
+            idx->capacity = capacity;
+        }
+        IndexEntry *e = &idx->entries[idx->count];
+        int64_t prev_max = idx->count > 0 ? idx->entries[idx->count - 1].max_time : INT64_MIN;
+        e->offset = offset;
+        e->first_id = t->ticket_id;
+        e->last_id = t->ticket_id;
+        e->min_time = t->timestamp;
+        e->max_time = t->timestamp > prev_max ? t->timestamp : prev_max;
+        e->agents = ticket_bloom(t);
+        idx->count++;
+    } else {
+        IndexEntry *e = &idx->entries[idx->count - 1];
+        e->last_id = t->ticket_id;
+        if (t->timestamp < e->min_time) e->min_time = t->timestamp;
+        if (t->timestamp > e->max_time) e->max_time = t->timestamp;
+        e->agents |= ticket_bloom(t);
+    }
+    idx->end = offset + t->length;
+    if (++idx->open_block == TICKET_INDEX_BLOCK) {
+        idx->open_block = 0;
+        off_t pos = (off_t)(sizeof(IndexHeader) + (idx->count - 1) * sizeof(IndexEntry));
+        if (idx->fd >= 0 &&
+            pwrite(idx->fd, &idx->entries[idx->count - 1], sizeof(IndexEntry), pos) != (ssize_t)sizeof(IndexEntry)) {
+            close(idx->fd);
+            idx->fd = -1;
+        }
+    }
+}
+
+/* Comprueba que la entrada 'i' describe un bloque completo del diario y devuelve su final. */
+static bool check_entry(const TicketIndex *idx, size_t i, JournalReader *r, uint64_t *end) {
+    const IndexEntry *e = &idx->entries[i];
+    if (e->offset < r->start || (i > 0 && e->offset <= idx->entries[i - 1].offset))
+        return false;
+    journal_seek(r, e->offset);
+    for (int n = 0; n < TICKET_INDEX_BLOCK; n++) {
+        const TicketHeader *t = journal_next(r);
+        if (!t || (n == 0 && t->ticket_id != e->first_id))
+            return false;
+    }
+    *end = r->pos;
+    return i + 1 == idx->count || idx->entries[i + 1].offset == r->pos;
+}
+
+/* Lee las entradas guardadas que siguen cuadrando con el diario. */
+static void load_entries(TicketIndex *idx, const char *path, bool writable, JournalReader *r) {
+    idx->fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (idx->fd < 0)
+        return;
+    struct stat st;
+    IndexHeader header;
+    size_t stored = 0;
+    if (fstat(idx->fd, &st) == 0 &&
+        pread(idx->fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+        memcmp(header.magic, TICKET_INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == TICKET_INDEX_VERSION && header.block == TICKET_INDEX_BLOCK &&
+        header.journal_created == idx->journal_created && r->map)
+        stored = ((size_t)st.st_size - sizeof(header)) / sizeof(IndexEntry);
+    if (stored > 0) {
+        idx->entries = malloc(stored * sizeof(IndexEntry));
+        if (idx->entries &&
+            pread(idx->fd, idx->entries, stored * sizeof(IndexEntry), sizeof(header)) ==
+                (ssize_t)(stored * sizeof(IndexEntry))) {
+            idx->count = stored;
+            idx->capacity = stored;
+        }
+    }
+    // Las entradas se añaden en orden: basta con quedarse con el prefijo válido.
+    size_t valid = 0;
+    uint64_t end = r->start;
+    while (valid < idx->count && check_entry(idx, valid, r, &end))
+        valid++;
+    idx->count = valid;
+    idx->end = valid > 0 ? end : r->start;
+    if (writable) {
+        if (valid == 0)
+            write_header(idx);
+        else if ((size_t)st.st_size != sizeof(header) + valid * sizeof(IndexEntry) &&
+                 ftruncate(idx->fd, (off_t)(sizeof(header) + valid * sizeof(IndexEntry))) != 0) {
+            close(idx->fd);
+            idx->fd = -1;
+        }
+    } else {
+        close(idx->fd);
+        idx->fd = -1;
+    }
+}
+
+/**
+ * Carga el índice del diario y lo completa con los tickets que falten. Con
+ * writable se crea o se repara el fichero y se mantiene abierto para que
+ * ticket_index_add() vaya añadiendo bloques.
+ *
+ * @param r  Lector ya abierto sobre el diario; queda en una posición cualquiera
+ * @return   false si no hay memoria; el índice vacío sigue siendo usable
+ */
+bool ticket_index_open(TicketIndex *idx, const char *journal_filename, JournalReader *r, bool writable) {
+    memset(idx, 0, sizeof(*idx));
+    idx->fd = -1;
+    idx->journal_created = r->created;
+    size_t len = strlen(journal_filename);
+    char *path = malloc(len + sizeof(TICKET_INDEX_SUFFIX));
+    if (!path) {
+        snprintf(idx->error, sizeof(idx->error), "out of memory");
+        return false;
+    }
+    memcpy(path, journal_filename, len);
+    memcpy(path + len, TICKET_INDEX_SUFFIX, sizeof(TICKET_INDEX_SUFFIX));
+    load_entries(idx, path, writable, r);
+    free(path);
+    if (!r->map)
+        return true;
+
+    journal_seek(r, idx->end);
+    const TicketHeader *t;
+    size_t pos = r->pos;
+    while ((t = journal_next(r)) != NULL) {
+        ticket_index_add(idx, t, pos);
+        pos = r->pos;
+    }
+    if (idx->failed) {
+        snprintf(idx->error, sizeof(idx->error), "out of memory");
+        return false;
+    }
+    return true;
+}
+
+void ticket_index_close(TicketIndex *idx) {
+    if (idx->fd >= 0)
+        close(idx->fd);
+    idx->fd = -1;
+    free(idx->entries);
+    idx->entries = NULL;
+    idx->count = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Búsquedas
+// ---------------------------------------------------------------------------
+/* Última entrada que cumple key(entry) <= value; count si ninguna. */
+#define LAST_AT_MOST(idx, field, value, out) do {                 \
+        size_t lo_ = 0, hi_ = (idx)->count;                       \
+        while (lo_ < hi_) {                                       \
+            size_t mid_ = lo_ + (hi_ - lo_) / 2;                  \
+            if ((idx)->entries[mid_].field <= (value)) lo_ = mid_ + 1; \
+            else hi_ = mid_;                                      \
+        }                                                         \
+        (out) = lo_ > 0 ? lo_ - 1 : (idx)->count;                 \
+    } while (0)
+
+/**
+ * Busca un ticket por su ID (los IDs crecen a lo largo del diario).
+ *
+ * @return  El ticket, o NULL si no está; el lector queda detrás de él
+ */
+const TicketHeader *ticket_index_find(const TicketIndex *idx, JournalReader *r, uint64_t ticket_id) {
+    size_t block;
+    LAST_AT_MOST(idx, first_id, ticket_id, block);
+    if (block < idx->count)
+        journal_seek(r, idx->entries[block].offset);
+    else if (idx->count > 0)
+        return NULL;
+    else
+        journal_seek(r, r->start);
+    const TicketHeader *t;
+    while ((t = journal_next(r)) != NULL && t->ticket_id < ticket_id)
+        ;
+    return t && t->ticket_id == ticket_id ? t : NULL;
+}
+
+/**
+ * Sitúa el lector en el primer ticket con fecha >= from. Los bloques
+ * anteriores al primero cuyo máximo acumulado llega a 'from' no pueden
+ * tener ninguno.
+ *
+ * @return  false si no hay tickets desde esa fecha
+ */
+bool ticket_index_seek_time(const TicketIndex *idx, JournalReader *r, int64_t from) {
+    size_t lo = 0, hi = idx->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->entries[mid].max_time < from) lo = mid + 1;
+        else hi = mid;
+    }
+    journal_seek(r, lo < idx->count ? idx->entries[lo].offset : idx->count > 0 ? idx->end : r->start);
+    size_t pos = r->pos;
+    const TicketHeader *t;
+    while ((t = journal_next(r)) != NULL && t->timestamp < from)
+        pos = r->pos;
+    journal_seek(r, pos);
+    return t != NULL;
+}
+
+/**
+ * Siguiente ticket de un agente a partir de la posición del lector,
+ * saltando los bloques cuyo filtro de Bloom descarta al agente.
+ */
+const TicketHeader *ticket_index_next_agent(const TicketIndex *idx, JournalReader *r,
+                                            const char *agent, size_t len) {
+    uint64_t bloom = ticket_index_agent_bloom(agent, len);
+    for (;;) {
+        size_t block;
+        LAST_AT_MOST(idx, offset, r->pos, block);
+        if (block < idx->count && r->pos < idx->end && (idx->entries[block].agents & bloom) != bloom) {
+            journal_seek(r, block + 1 < idx->count ? idx->entries[block + 1].offset : idx->end);
+            continue;
+        }
+        const TicketHeader *t = journal_next(r);
+        if (!t)
+            return NULL;
+        if (strnlen(t->agent, sizeof(t->agent)) == len && memcmp(t->agent, agent, len) == 0)
+            return t;
+    }
+}
@@ -0,0 +1,76 @@
+/*
+  Índice disperso del diario de tickets.
+
+  Una entrada por cada TICKET_INDEX_BLOCK tickets: dónde empieza el bloque
+  en el diario, su primer y último ID, sus fechas y un filtro de Bloom con
+  los agentes que vendieron en él. Buscar un ticket o una fecha es una
+  búsqueda binaria sobre las entradas y recorrer como mucho un bloque; para
+  filtrar por agente se saltan los bloques cuyo filtro lo descarta.
+
+  El fichero (diario + ".idx") solo guarda bloques completos y se rehace a
+  partir del diario si no cuadra con él, así que no necesita fdatasync():
+  el POS añade una entrada cada vez que cierra un bloque y quien lo abre
+  recorre solo los tickets que hay después de la última.
+
+  Formato (versión 1):
+    IndexHeader (32 bytes) | IndexEntry (48 bytes) x bloques completos
+*/
+#ifndef TICKET_INDEX_H
+#define TICKET_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "journal.h"
+
+#define TICKET_INDEX_MAGIC   "POSTIDX\n"
+#define TICKET_INDEX_VERSION 1
+#define TICKET_INDEX_BLOCK   64        // Tickets por entrada
+#define TICKET_INDEX_SUFFIX  ".idx"    // Fichero del índice: diario + sufijo
+
+typedef struct {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  block;              // TICKET_INDEX_BLOCK del que lo escribió
+    int64_t   journal_created;    // Debe coincidir con la cabecera del diario
+    uint64_t  reserved;
+} IndexHeader;
+
+typedef struct {
+    uint64_t  offset;             // Primer registro del bloque en el diario
+    uint64_t  first_id;
+    uint64_t  last_id;
+    int64_t   min_time;           // Fecha más antigua del bloque
+    int64_t   max_time;           // Fecha más reciente hasta este bloque (no decrece)
+    uint64_t  agents;             // Filtro de Bloom de los agentes del bloque
+} IndexEntry;
+
+_Static_assert(sizeof(IndexHeader) == 32, "IndexHeader forma parte del formato");
+_Static_assert(sizeof(IndexEntry) == 48, "IndexEntry forma parte del formato");
+
+typedef struct TicketIndex {
+    int          fd;              // -1 si solo se lee
+    int64_t      journal_created;
+    IndexEntry  *entries;         // Bloques completos y, al final, el que está a medias
+    size_t       count;           // Entradas, incluida la del bloque a medias
+    size_t       capacity;
+    uint32_t     open_block;      // Tickets del último bloque si está a medias; 0 si no
+    uint64_t     end;             // Final del último ticket indexado
+    bool         failed;          // Sin memoria: las búsquedas recorren el diario
+    char         error[128];
+} TicketIndex;
+
+bool ticket_index_open(TicketIndex *idx, const char *journal_filename, JournalReader *r, bool writable);
+void ticket_index_add(TicketIndex *idx, const TicketHeader *t, uint64_t offset);
+void ticket_index_close(TicketIndex *idx);
+
+uint64_t ticket_index_agent_bloom(const char *agent, size_t len);
+
+// Búsquedas: dejan el lector en el primer ticket que puede cumplir la condición.
+const TicketHeader *ticket_index_find(const TicketIndex *idx, JournalReader *r, uint64_t ticket_id);
+bool ticket_index_seek_time(const TicketIndex *idx, JournalReader *r, int64_t from);
+const TicketHeader *ticket_index_next_agent(const TicketIndex *idx, JournalReader *r,
+                                            const char *agent, size_t len);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+  Reparto de IDs de ticket por bloques arrendados, con un arriendo duradero
+  por bloque en lugar de una escritura por venta.
+*/
+
+#include "ticket_seq.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#define fdatasync fsync
+#endif
+
+/* Lee el arriendo guardado; false si no existe o no se entiende. */
+static bool read_lease(const char *filename, uint64_t *start, uint64_t *end) {
+    FILE *file = fopen(filename, "r");
+    if (!file)
+        return false;
+    bool ok = fscanf(file, "%" SCNu64 " %" SCNu64, start, end) == 2 && *start <= *end;
+    fclose(file);
+    return ok;
+}
+
+/* Guarda el arriendo [start, end) en disco antes de entregar ninguno de sus IDs. */
+static bool write_lease(TicketSeq *seq, uint64_t start, uint64_t end) {
+    size_t len = strlen(seq->filename);
+    char *tmp = malloc(len + 5);
+    if (!tmp)
+        return false;
+    memcpy(tmp, seq->filename, len);
+    memcpy(tmp + len, ".tmp", 5);
+    FILE *file = fopen(tmp, "w");
+    bool ok = file != NULL;
+    if (ok) {
+        ok = fprintf(file, "%" PRIu64 " %" PRIu64 "\n", start, end) > 0;
+        ok = fflush(file) == 0 && fdatasync(fileno(file)) == 0 && ok;
+        ok = fclose(file) == 0 && ok;
+    }
+    ok = ok && rename(tmp, seq->filename) == 0;
+    if (!ok) remove(tmp);
+    free(tmp);
+    if (!ok) {
+        snprintf(seq->error, sizeof(seq->error), "cannot write ticket lease '%s'", seq->filename);
+        return false;
+    }
+    seq->lease_start = start;
+    seq->lease_end = end;
+    return true;
+}
+
+/**
+ * Prepara la numeración. Sin fichero de arriendo se empieza en 'first'
+ * (por ejemplo, el contador antiguo); después manda el diario.
+ *
+ * @param journal  Diario ya abierto; su último ticket fija el siguiente ID
+ * @param block    IDs por arriendo (0 para TICKET_SEQ_BLOCK)
+ * @return         false si no se puede escribir el arriendo (ver seq->error)
+ */
+bool ticket_seq_open(TicketSeq *seq, const char *filename, uint64_t first,
+                     const Journal *journal, uint64_t block) {
+    memset(seq, 0, sizeof(*seq));
+    seq->block = block ? block : TICKET_SEQ_BLOCK;
+    seq->filename = strdup(filename);
+    if (!seq->filename) {
+        snprintf(seq->error, sizeof(seq->error), "out of memory");
+        return false;
+    }
+    uint64_t start, end;
+    if (read_lease(filename, &start, &end)) {
+        seq->lease_start = start;
+        seq->lease_end = end;
+        if (journal->has_tickets && journal->last_ticket >= start)
+            seq->next = journal->last_ticket + 1;
+        else
+            seq->next = end;
+    } else {
+        seq->next = first;
+        if (journal->has_tickets && journal->last_ticket >= first)
+            seq->next = journal->last_ticket + 1;
+    }
+    // El siguiente ID debe quedar dentro de un arriendo ya guardado.
+    if (seq->next < seq->lease_start || seq->next >= seq->lease_end)
+        return write_lease(seq, seq->next, seq->next + seq->block);
+    return true;
+}
+
+/**
+ * Entrega el siguiente ID. Solo toca el disco al agotarse el bloque.
+ *
+ * @return  false si no se pudo arrendar un bloque nuevo (ver seq->error)
+ */
+bool ticket_seq_next(TicketSeq *seq, uint64_t *id) {
+    if (seq->next >= seq->lease_end && !write_lease(seq, seq->next, seq->next + seq->block))
+        return false;
+    *id = seq->next++;
+    return true;
+}
+
+void ticket_seq_close(TicketSeq *seq) {
+    free(seq->filename);
+    seq->filename = NULL;
+}
@@ -0,0 +1,39 @@
+/*
+  Numeración de tickets.
+
+  Los IDs se reparten en memoria a partir de bloques arrendados: el fichero
+  de arriendo guarda el bloque en curso ("inicio fin") y solo se reescribe,
+  con fdatasync() y rename(), cuando se agota un bloque. Ningún ID de un
+  bloque se entrega antes de que el bloque esté en disco.
+
+  Tras un corte, la numeración sigue en el último ticket del diario más uno
+  (nunca por debajo del inicio del bloque), así que no se repiten IDs; los
+  que se entregaron y no llegaron al diario se vuelven a usar, porque esas
+  ventas no quedaron registradas. Sin tickets en el diario se salta al final
+  del bloque.
+*/
+#ifndef TICKET_SEQ_H
+#define TICKET_SEQ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "journal.h"
+
+#define TICKET_SEQ_BLOCK 1000     // IDs por arriendo
+
+typedef struct {
+    char     *filename;
+    uint64_t  next;               // Siguiente ID a entregar
+    uint64_t  lease_start;        // Bloque arrendado: [lease_start, lease_end)
+    uint64_t  lease_end;
+    uint64_t  block;
+    char      error[128];
+} TicketSeq;
+
+bool ticket_seq_open(TicketSeq *seq, const char *filename, uint64_t first,
+                     const Journal *journal, uint64_t block);
+bool ticket_seq_next(TicketSeq *seq, uint64_t *id);
+void ticket_seq_close(TicketSeq *seq);
+
+#endif
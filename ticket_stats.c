@@ -0,0 +1,319 @@
+/*
+  Agregación paralela del diario: los segmentos se cortan en trozos que los
+  hilos van tomando, una tabla hash por hilo y una fusión al final.
+*/
+
+#include "ticket_stats.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TABLE_MIN_CAPACITY 1024   // Potencia de dos
+
+typedef struct {
+    StatsRow *rows;               // Direccionamiento abierto, sondeo lineal
+    size_t    count;
+    size_t    capacity;
+    bool      failed;             // Sin memoria
+} StatsTable;
+
+typedef struct {
+    const JournalReader *reader;
+    size_t        start;
+    size_t        end;
+} StatsChunk;
+
+typedef struct {
+    const StatsChunk *chunks;
+    size_t        chunk_count;
+    _Atomic size_t *next_chunk;   // Compartido: siguiente trozo sin tomar
+    StatsGroup    group;
+    int64_t       from;
+    int64_t       to;
+    StatsTable    table;
+    uint64_t      tickets;
+    Money         total;
+    bool          torn;
+    pthread_t     thread;
+} StatsWorker;
+
+// ---------------------------------------------------------------------------
+// Tabla hash
+// ---------------------------------------------------------------------------
+static inline size_t key_hash(uint64_t id, const char *agent) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ id;
+    for (size_t i = 0; i < JOURNAL_AGENT_SIZE && agent[i]; i++) {
+        h ^= (unsigned char)agent[i];
+        h *= 0x100000001b3ULL;
+    }
+    return (size_t)((h ^ (h >> 29)) * 0x9e3779b97f4a7c15ULL >> 17);
+}
+
+static StatsRow *table_probe(StatsRow *rows, size_t capacity, uint64_t id, const char *agent) {
+    size_t mask = capacity - 1;
+    for (size_t i = key_hash(id, agent) & mask;; i = (i + 1) & mask) {
+        StatsRow *row = &rows[i];
+        if (!row->used || (row->id == id && memcmp(row->agent, agent, JOURNAL_AGENT_SIZE) == 0))
+            return row;
+    }
+}
+
+static bool table_grow(StatsTable *table) {
+    size_t capacity = table->capacity ? table->capacity * 2 : TABLE_MIN_CAPACITY;
+    StatsRow *rows = calloc(capacity, sizeof(StatsRow));
+    if (!rows) {
+        table->failed = true;
+        return false;
+    }
+    for (size_t i = 0; i < table->capacity; i++)
+        if (table->rows[i].used)
+            *table_probe(rows, capacity, table->rows[i].id, table->rows[i].agent) = table->rows[i];
+    free(table->rows);
+    table->rows = rows;
+    table->capacity = capacity;
+    return true;
+}
+
+/* Suma a la fila de la clave, creándola si no existe. 'agent' ocupa JOURNAL_AGENT_SIZE bytes. */
+static void table_add(StatsTable *table, uint64_t id, const char *agent, const char *name,
+                      int64_t count, Money amount) {
+    // Carga máxima del 70 %.
+    if ((table->count + 1) * 10 > table->capacity * 7 && !table_grow(table))
+        return;
+    StatsRow *row = table_probe(table->rows, table->capacity, id, agent);
+    if (!row->used) {
+        row->used = true;
+        row->id = id;
+        memcpy(row->agent, agent, JOURNAL_AGENT_SIZE);
+        row->name = name;
+        table->count++;
+    }
+    row->count += count;
+    row->amount += amount;
+}
+
+// ---------------------------------------------------------------------------
+// Hilos
+// ---------------------------------------------------------------------------
+/* Hora local de 'when'; localtime_r() solo se llama al cambiar de hora. */
+static uint64_t ticket_hour(int64_t when, int64_t *hour_start, uint64_t *hour) {
+    if (when < *hour_start || when >= *hour_start + 3600) {
+        time_t t = (time_t)when;
+        struct tm tm;
+        if (!localtime_r(&t, &tm))
+            return 0;
+        *hour_start = when - tm.tm_min * 60 - tm.tm_sec;
+        *hour = (uint64_t)tm.tm_hour;
+    }
+    return *hour;
+}
+
+/* Agrega un trozo en la tabla del hilo. */
+static void aggregate_chunk(StatsWorker *w, const StatsChunk *chunk) {
+    static const char no_agent[JOURNAL_AGENT_SIZE];
+    char agent[JOURNAL_AGENT_SIZE];
+    int64_t hour_start = INT64_MIN + 3600;
+    uint64_t hour = 0;
+    // Copia del lector: misma proyección, posición propia.
+    JournalReader reader = *chunk->reader;
+    const TicketHeader *t;
+    journal_seek(&reader, chunk->start);
+    while (reader.pos < chunk->end && !w->table.failed && (t = journal_next(&reader)) != NULL) {
+        if (t->timestamp < w->from || t->timestamp >= w->to)
+            continue;
+        w->tickets++;
+        w->total += t->total;
+        switch (w->group) {
+            case STATS_BY_PRODUCT: {
+                const TicketLine *lines = ticket_lines(t);
+                const char *name = ticket_names(t);
+                for (uint32_t i = 0; i < t->line_count; i++) {
+                    table_add(&w->table, (uint64_t)(uint32_t)lines[i].ID, no_agent, name,
+                              lines[i].qty, lines[i].unit_price * lines[i].qty);
+                    name += strlen(name) + 1;
+                }
+                break;
+            }
+            case STATS_BY_AGENT: {
+                size_t len = strnlen(t->agent, sizeof(t->agent));
+                memcpy(agent, t->agent, len);
+                memset(agent + len, 0, sizeof(agent) - len);
+                table_add(&w->table, 0, agent, NULL, 1, t->total);
+                break;
+            }
+            case STATS_BY_HOUR:
+                table_add(&w->table, ticket_hour(t->timestamp, &hour_start, &hour), no_agent, NULL,
+                          1, t->total);
+                break;
+        }
+    }
+    w->torn |= reader.torn;
+}
+
+static void *stats_worker(void *arg) {
+    StatsWorker *w = arg;
+    size_t i;
+    while ((i = atomic_fetch_add(w->next_chunk, 1)) < w->chunk_count)
+        aggregate_chunk(w, &w->chunks[i]);
+    return NULL;
+}
+
+/* Primera entrada del índice cuyo bloque empieza después de 'pos'. */
+static size_t first_block_after(const TicketIndex *idx, size_t pos) {
+    size_t lo = 0, hi = idx->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->entries[mid].offset <= pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// ---------------------------------------------------------------------------
+// Resultado
+// ---------------------------------------------------------------------------
+static int compare_amount(const void *a, const void *b) {
+    const StatsRow *x = a, *y = b;
+    if (x->amount != y->amount) return x->amount > y->amount ? -1 : 1;
+    if (x->count != y->count) return x->count > y->count ? -1 : 1;
+    if (x->id != y->id) return x->id < y->id ? -1 : 1;
+    return memcmp(x->agent, y->agent, JOURNAL_AGENT_SIZE);
+}
+
+static int compare_id(const void *a, const void *b) {
+    const StatsRow *x = a, *y = b;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/*
+  Extremos del intervalo en un segmento, con su índice, cortados en como
+  mucho 'parts' trozos por bloques del índice a partes iguales.
+*/
+static size_t split_source(const StatsSource *src, int64_t from, int64_t to, unsigned parts,
+                           StatsChunk *chunks) {
+    const TicketIndex *idx = src->index;
+    JournalReader seek = *src->reader;
+    ticket_index_seek_time(idx, &seek, from);
+    size_t start = seek.pos;
+    size_t end = src->reader->size;
+    if (to < INT64_MAX && ticket_index_seek_time(idx, &seek, to))
+        end = seek.pos > start ? seek.pos : start;
+    if (start >= end)
+        return 0;
+    size_t lo = first_block_after(idx, start);
+    size_t hi = first_block_after(idx, end - 1);
+    size_t blocks = hi > lo ? hi - lo : 0;
+    if (parts > blocks + 1) parts = (unsigned)(blocks + 1);
+    for (unsigned i = 0; i < parts; i++) {
+        chunks[i].reader = src->reader;
+        chunks[i].start = i == 0 ? start : idx->entries[lo + i * blocks / parts].offset;
+        chunks[i].end = i + 1 == parts ? end : idx->entries[lo + (i + 1) * blocks / parts].offset;
+    }
+    return parts;
+}
+
+/**
+ * Agrega los tickets con fecha en [from, to) de varios segmentos del diario.
+ *
+ * Las filas del resultado apuntan a nombres dentro de las proyecciones de
+ * los lectores, así que deben seguir abiertos mientras se usen.
+ *
+ * @param sources  Lector e índice de cada segmento; los lectores no se mueven
+ * @param threads  Hilos como mucho (0 = uno)
+ * @return         false si faltó memoria
+ */
+bool ticket_stats_run(const StatsSource *sources, size_t count, StatsGroup group,
+                      int64_t from, int64_t to, unsigned threads, StatsResult *out) {
+    memset(out, 0, sizeof(*out));
+    if (threads == 0) threads = 1;
+    if (threads > TICKET_STATS_MAX_THREADS) threads = TICKET_STATS_MAX_THREADS;
+    StatsChunk *chunks = count > 0 ? calloc(count * threads, sizeof(StatsChunk)) : NULL;
+    StatsWorker *workers = calloc(threads, sizeof(StatsWorker));
+    if ((count > 0 && !chunks) || !workers) {
+        free(chunks);
+        free(workers);
+        snprintf(out->error, sizeof(out->error), "out of memory");
+        return false;
+    }
+    size_t chunk_count = 0;
+    for (size_t i = 0; i < count; i++)
+        if (sources[i].reader->map)
+            chunk_count += split_source(&sources[i], from, to, threads, chunks + chunk_count);
+    if (threads > chunk_count) threads = chunk_count > 0 ? (unsigned)chunk_count : 1;
+
+    _Atomic size_t next_chunk = 0;
+    unsigned started = 0;
+    StatsWorker *inline_worker = NULL;
+    for (unsigned i = 0; i < threads; i++) {
+        StatsWorker *w = &workers[i];
+        w->chunks = chunks;
+        w->chunk_count = chunk_count;
+        w->next_chunk = &next_chunk;
+        w->group = group;
+        w->from = from;
+        w->to = to;
+        // Si no se puede crear el hilo, sus trozos se los llevan los demás o este.
+        if (pthread_create(&w->thread, NULL, stats_worker, w) == 0) {
+            started++;
+        } else {
+            w->thread = pthread_self();
+            if (!inline_worker) inline_worker = w;
+        }
+    }
+    if (inline_worker)
+        stats_worker(inline_worker);
+
+    // Se funden todas las tablas en la del primer hilo.
+    StatsTable *merged = &workers[0].table;
+    bool failed = false;
+    for (unsigned i = 0; i < threads; i++) {
+        StatsWorker *w = &workers[i];
+        if (!pthread_equal(w->thread, pthread_self()))
+            pthread_join(w->thread, NULL);
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        StatsWorker *w = &workers[i];
+        out->tickets += w->tickets;
+        out->total += w->total;
+        out->torn |= w->torn;
+        failed |= w->table.failed;
+        if (i == 0)
+            continue;
+        for (size_t k = 0; k < w->table.capacity && !merged->failed; k++) {
+            const StatsRow *row = &w->table.rows[k];
+            if (row->used)
+                table_add(merged, row->id, row->agent, row->name, row->count, row->amount);
+        }
+        free(w->table.rows);
+    }
+    failed |= merged->failed;
+
+    // Filas juntas al principio y ordenadas.
+    size_t rows = 0;
+    for (size_t k = 0; k < merged->capacity; k++)
+        if (merged->rows[k].used)
+            merged->rows[rows++] = merged->rows[k];
+    if (rows > 1)
+        qsort(merged->rows, rows, sizeof(StatsRow), group == STATS_BY_HOUR ? compare_id : compare_amount);
+    out->rows = merged->rows;
+    out->count = rows;
+    out->threads = started > 0 ? started : 1;
+    free(workers);
+    free(chunks);
+    if (failed) {
+        snprintf(out->error, sizeof(out->error), "out of memory");
+        ticket_stats_free(out);
+        return false;
+    }
+    return true;
+}
+
+void ticket_stats_free(StatsResult *out) {
+    free(out->rows);
+    out->rows = NULL;
+    out->count = 0;
+}
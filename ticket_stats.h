@@ -0,0 +1,61 @@
+/*
+  Ventas agregadas sobre el diario de tickets, en paralelo.
+
+  En cada segmento del diario, el intervalo de fechas se localiza con su
+  índice y se reparte en trozos que empiezan en bloques del índice, así que
+  cada hilo arranca en un registro sin tener que buscarlo. Los hilos toman
+  trozos de una lista común, los recorren sobre el segmento proyectado y
+  agregan en su propia tabla hash, sin cerrojos; al final las tablas se
+  funden en una y se ordenan por importe.
+
+  Se agrupa por producto (unidades e importe de las líneas), por agente o
+  por hora del día (tickets e importe).
+*/
+#ifndef TICKET_STATS_H
+#define TICKET_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "journal.h"
+#include "money.h"
+#include "ticket_index.h"
+
+#define TICKET_STATS_MAX_THREADS 64
+
+typedef enum {
+    STATS_BY_PRODUCT,
+    STATS_BY_AGENT,
+    STATS_BY_HOUR
+} StatsGroup;
+
+typedef struct {
+    uint64_t    id;                        // ID del producto u hora (0-23)
+    char        agent[JOURNAL_AGENT_SIZE]; // Sin '\0' si ocupa todo
+    bool        used;
+    const char *name;                      // Nombre del producto, dentro del diario proyectado
+    int64_t     count;                     // Unidades, o tickets por agente y hora
+    Money       amount;
+} StatsRow;
+
+typedef struct {
+    StatsRow   *rows;         // Ordenadas por importe (por hora, en orden de hora)
+    size_t      count;
+    uint64_t    tickets;
+    Money       total;
+    unsigned    threads;      // Hilos que se usaron
+    bool        torn;         // Algún segmento termina en un registro dañado
+    char        error[128];
+} StatsResult;
+
+typedef struct {
+    const JournalReader *reader;
+    const TicketIndex   *index;
+} StatsSource;
+
+bool ticket_stats_run(const StatsSource *sources, size_t count, StatsGroup group,
+                      int64_t from, int64_t to, unsigned threads, StatsResult *out);
+void ticket_stats_free(StatsResult *out);
+
+#endif
@@ -0,0 +1,507 @@
+/*
+  Utilidades sobre el diario de tickets del POS.
+
+    ticket_tool export <diario> [salida]
+    ticket_tool reprint <diario> <ticket>
+    ticket_tool range <diario> <desde> [hasta] [agente]
+    ticket_tool top <diario> <producto|agente|hora> <desde> [hasta] [n]
+    ticket_tool follow <diario> [agente]
+
+  export vuelca los tickets en el mismo texto que escribía transactions.csv:
+  una línea de cabecera por ticket y una por producto. reprint y range usan
+  el índice del diario para ir directos a un ticket o a un intervalo de
+  fechas ("AAAA-MM-DD" o "AAAA-MM-DD HH:MM[:SS]", ambas incluidas).
+
+  top agrega las ventas del intervalo con todos los núcleos y muestra los n
+  primeros (100 por defecto, 0 = todos) por importe. Las fechas de top
+  admiten también un trimestre, "AAAA-Q1" a "AAAA-Q4".
+
+  follow muestra las ventas según llegan al diario, sin releerlo: duerme en
+  inotify sobre el directorio del diario (o sondea si no hay) y a cada aviso
+  lee solo los registros nuevos; cuando el POS sella el segmento, termina
+  de leerlo y sigue en el nuevo.
+*/
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "journal.h"
+#include "ticket_index.h"
+#include "ticket_stats.h"
+
+#define FOLLOW_POLL_MS    250   // Sondeo de follow sin inotify
+#define FOLLOW_RECHECK_MS 5000  // Con inotify, por si se pierde un aviso
+
+/* Texto de un ticket: cabecera y una línea por producto. */
+static void print_ticket(FILE *out, const TicketHeader *ticket) {
+    char line[TICKET_TEXT_SIZE];
+    ticket_header_text(ticket, line, sizeof(line));
+    fprintf(out, "%s\n", line);
+    const char *name = ticket_names(ticket);
+    for (uint32_t i = 0; i < ticket->line_count; i++) {
+        ticket_line_text(&ticket_lines(ticket)[i], name, line, sizeof(line));
+        fprintf(out, "%s\n", line);
+        name += strlen(name) + 1;
+    }
+}
+
+static void report_torn(const JournalReader *reader, const char *filename) {
+    if (reader->torn)
+        fprintf(stderr, "Aviso: '%s' termina en un registro incompleto o dañado "
+                        "(desplazamiento %zu); se ignora.\n", filename, reader->pos);
+}
+
+static bool list_segments(const char *journalFile, JournalSegments *segments) {
+    if (!journal_segments_open(segments, journalFile)) {
+        fprintf(stderr, "No se pueden listar los segmentos de '%s': %s\n", journalFile, segments->error);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Escribe el texto de todos los tickets del diario, segmento a segmento.
+ *
+ * @param journalFile  Diario a leer
+ * @param outputFile   Fichero de salida; NULL para la salida estándar
+ * @return             Tickets exportados, o -1 si hubo un error
+ */
+static long export_tickets(const char *journalFile, const char *outputFile) {
+    JournalSegments segments;
+    if (!list_segments(journalFile, &segments))
+        return -1;
+    FILE *out = outputFile ? fopen(outputFile, "w") : stdout;
+    if (!out) {
+        perror("Error al crear el archivo de salida");
+        journal_segments_close(&segments);
+        return -1;
+    }
+
+    long count = 0;
+    bool failed = false;
+    for (size_t i = 0; i < segments.count && !failed; i++) {
+        JournalReader reader;
+        if (!journal_reader_open(&reader, segments.items[i].filename)) {
+            fprintf(stderr, "No se puede leer '%s': %s\n", segments.items[i].filename, reader.error);
+            failed = true;
+            break;
+        }
+        const TicketHeader *ticket;
+        while ((ticket = journal_next(&reader)) != NULL) {
+            print_ticket(out, ticket);
+            count++;
+        }
+        report_torn(&reader, segments.items[i].filename);
+        journal_reader_close(&reader);
+    }
+    journal_segments_close(&segments);
+
+    failed |= ferror(out) != 0;
+    if (outputFile && fclose(out) != 0)
+        failed = true;
+    if (failed) {
+        fprintf(stderr, "Error al exportar los tickets.\n");
+        return -1;
+    }
+    return count;
+}
+
+/* Abre un segmento y su índice, sin modificar el fichero del índice. */
+static bool open_indexed(const char *journalFile, JournalReader *reader, TicketIndex *index) {
+    if (!journal_reader_open(reader, journalFile)) {
+        fprintf(stderr, "No se puede leer el diario '%s': %s\n", journalFile, reader->error);
+        return false;
+    }
+    if (!ticket_index_open(index, journalFile, reader, false)) {
+        fprintf(stderr, "No se puede cargar el índice: %s\n", index->error);
+        journal_reader_close(reader);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Vuelve a imprimir un ticket. Solo se abren los segmentos cuyo pie
+ * admite el ID.
+ *
+ * @return  0 si se encontró, 1 si no
+ */
+static int reprint_ticket(const char *journalFile, const char *id_text) {
+    char *rest;
+    unsigned long long id = strtoull(id_text, &rest, 10);
+    if (*id_text == '\0' || *rest != '\0') {
+        fprintf(stderr, "Número de ticket inválido: %s\n", id_text);
+        return 1;
+    }
+    JournalSegments segments;
+    if (!list_segments(journalFile, &segments))
+        return 1;
+    bool found = false;
+    for (size_t i = 0; i < segments.count && !found; i++) {
+        const JournalSegment *seg = &segments.items[i];
+        JournalReader reader;
+        TicketIndex index;
+        if (!journal_segment_has_ticket(seg, id) || !open_indexed(seg->filename, &reader, &index))
+            continue;
+        const TicketHeader *ticket = ticket_index_find(&index, &reader, id);
+        if (ticket) {
+            print_ticket(stdout, ticket);
+            found = true;
+        }
+        report_torn(&reader, seg->filename);
+        ticket_index_close(&index);
+        journal_reader_close(&reader);
+    }
+    journal_segments_close(&segments);
+    if (!found)
+        fprintf(stderr, "No existe el ticket %llu.\n", id);
+    return found ? 0 : 1;
+}
+
+/**
+ * Imprime los tickets de un intervalo de fechas, opcionalmente de un agente,
+ * leyendo solo los segmentos que pueden tenerlos.
+ *
+ * @return  0 si todo fue bien
+ */
+static int print_range(const char *journalFile, const char *from_text, const char *to_text,
+                       const char *agent) {
+    int64_t from, to, unused;
+    if (!ticket_time_parse(from_text, &from, &unused) || !ticket_time_parse(to_text, &unused, &to)) {
+        fprintf(stderr, "Fecha inválida (use AAAA-MM-DD o AAAA-MM-DD HH:MM:SS).\n");
+        return 1;
+    }
+    JournalSegments segments;
+    if (!list_segments(journalFile, &segments))
+        return 1;
+    long count = 0;
+    size_t agent_len = agent ? strnlen(agent, JOURNAL_AGENT_SIZE) : 0;
+    bool done = false;
+    for (size_t i = 0; i < segments.count && !done; i++) {
+        const JournalSegment *seg = &segments.items[i];
+        JournalReader reader;
+        TicketIndex index;
+        if (!journal_segment_has_time(seg, from, to) ||
+            (agent && !journal_segment_has_agent(seg, agent, agent_len)) ||
+            !open_indexed(seg->filename, &reader, &index))
+            continue;
+        const TicketHeader *ticket;
+        ticket_index_seek_time(&index, &reader, from);
+        while ((ticket = agent ? ticket_index_next_agent(&index, &reader, agent, agent_len)
+                               : journal_next(&reader)) != NULL) {
+            // El diario va en orden de venta: el primero posterior cierra el intervalo.
+            if (ticket->timestamp >= to) {
+                done = true;
+                break;
+            }
+            if (ticket->timestamp >= from) {
+                print_ticket(stdout, ticket);
+                count++;
+            }
+        }
+        report_torn(&reader, seg->filename);
+        ticket_index_close(&index);
+        journal_reader_close(&reader);
+    }
+    journal_segments_close(&segments);
+    fprintf(stderr, "%ld tickets.\n", count);
+    return 0;
+}
+
+/* Como ticket_time_parse(), pero también acepta un trimestre "AAAA-Qn". */
+static bool period_parse(const char *text, int64_t *from, int64_t *to) {
+    int year, quarter;
+    char end;
+    if (sscanf(text, "%4d-%*[Qq]%1d%c", &year, &quarter, &end) != 2 || quarter < 1 || quarter > 4)
+        return ticket_time_parse(text, from, to);
+    struct tm tm = { .tm_year = year - 1900, .tm_mon = (quarter - 1) * 3, .tm_mday = 1, .tm_isdst = -1 };
+    *from = (int64_t)mktime(&tm);
+    tm = (struct tm){ .tm_year = year - 1900, .tm_mon = quarter * 3, .tm_mday = 1, .tm_isdst = -1 };
+    *to = (int64_t)mktime(&tm);
+    return *from != -1 && *to != -1;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * Ventas del intervalo agrupadas por producto, agente u hora, de mayor a
+ * menor importe (por hora, en orden de hora).
+ *
+ * @return  0 si todo fue bien
+ */
+static int print_top(const char *journalFile, const char *group_text, const char *from_text,
+                     const char *to_text, const char *limit_text) {
+    StatsGroup group;
+    if (strcmp(group_text, "producto") == 0) group = STATS_BY_PRODUCT;
+    else if (strcmp(group_text, "agente") == 0) group = STATS_BY_AGENT;
+    else if (strcmp(group_text, "hora") == 0) group = STATS_BY_HOUR;
+    else {
+        fprintf(stderr, "Agrupación no reconocida: %s (use producto, agente u hora).\n", group_text);
+        return 1;
+    }
+    int64_t from, to, unused;
+    if (!period_parse(from_text, &from, &unused) || !period_parse(to_text, &unused, &to)) {
+        fprintf(stderr, "Fecha inválida (use AAAA-MM-DD, AAAA-MM-DD HH:MM:SS o AAAA-Qn).\n");
+        return 1;
+    }
+    char *rest;
+    unsigned long limit = limit_text ? strtoul(limit_text, &rest, 10) : 100;
+    if (limit_text && (*limit_text == '\0' || *rest != '\0')) {
+        fprintf(stderr, "Número de filas inválido: %s\n", limit_text);
+        return 1;
+    }
+    // Solo los segmentos del intervalo; quedan abiertos mientras se usan los nombres.
+    JournalSegments segments;
+    if (!list_segments(journalFile, &segments))
+        return 1;
+    JournalReader *readers = calloc(segments.count + 1, sizeof(JournalReader));
+    TicketIndex *indexes = calloc(segments.count + 1, sizeof(TicketIndex));
+    StatsSource *sources = calloc(segments.count + 1, sizeof(StatsSource));
+    size_t opened = 0;
+    bool ok = readers && indexes && sources;
+    for (size_t i = 0; ok && i < segments.count; i++) {
+        const JournalSegment *seg = &segments.items[i];
+        if (!journal_segment_has_time(seg, from, to))
+            continue;
+        ok = open_indexed(seg->filename, &readers[opened], &indexes[opened]);
+        if (ok) {
+            sources[opened].reader = &readers[opened];
+            sources[opened].index = &indexes[opened];
+            opened++;
+        }
+    }
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    double started = now_seconds();
+    StatsResult result;
+    if (ok) {
+        ok = ticket_stats_run(sources, opened, group, from, to, cores > 0 ? (unsigned)cores : 1, &result);
+        if (!ok)
+            fprintf(stderr, "No se pudieron agregar las ventas: %s\n", result.error);
+    } else if (!readers || !indexes || !sources) {
+        fprintf(stderr, "No hay memoria suficiente.\n");
+    }
+    double elapsed = now_seconds() - started;
+
+    if (ok) {
+        char amount[MONEY_BUFSIZE];
+        size_t shown = limit == 0 || limit > result.count ? result.count : limit;
+        if (group == STATS_BY_PRODUCT)
+            printf("%5s %10s  %-40s %10s %14s\n", "#", "ID", "Producto", "Unidades", "Importe");
+        else
+            printf("%5s  %-20s %10s %14s\n", "#", group == STATS_BY_AGENT ? "Agente" : "Hora", "Tickets", "Importe");
+        for (size_t i = 0; i < shown; i++) {
+            const StatsRow *row = &result.rows[i];
+            money_format(row->amount, amount);
+            if (group == STATS_BY_PRODUCT)
+                printf("%5zu %10llu  %-40.40s %10lld %14s\n", i + 1, (unsigned long long)row->id,
+                       row->name ? row->name : "", (long long)row->count, amount);
+            else if (group == STATS_BY_AGENT)
+                printf("%5zu  %-20.*s %10lld %14s\n", i + 1, (int)strnlen(row->agent, sizeof(row->agent)),
+                       row->agent, (long long)row->count, amount);
+            else
+                printf("%5zu  %02llu:00%14s %10lld %14s\n", i + 1, (unsigned long long)row->id, "",
+                       (long long)row->count, amount);
+        }
+        money_format(result.total, amount);
+        fprintf(stderr, "%llu tickets, total %s, %zu filas, %zu segmentos de %zu, %u hilos, %.2f s.\n",
+                (unsigned long long)result.tickets, amount, result.count, opened, segments.count,
+                result.threads, elapsed);
+        if (result.torn)
+            fprintf(stderr, "Aviso: el diario contiene un registro dañado; se ignora lo que le sigue.\n");
+        ticket_stats_free(&result);
+    }
+    for (size_t i = 0; i < opened; i++) {
+        ticket_index_close(&indexes[i]);
+        journal_reader_close(&readers[i]);
+    }
+    free(sources);
+    free(indexes);
+    free(readers);
+    journal_segments_close(&segments);
+    return ok ? 0 : 1;
+}
+
+// ---------------------------------------------------------------------------
+// follow
+// ---------------------------------------------------------------------------
+typedef struct {
+    const char   *filename;
+    int           fd;         // Segmento que se sigue; sigue abierto aunque se renombre
+    JournalReader reader;
+    size_t        pos;        // Siguiente registro por leer (0 = el primero)
+} Follower;
+
+/*
+  Vuelve a proyectar el segmento si ha cambiado de tamaño o se paró en un
+  registro a medio escribir, sin perder la posición: ese registro se vuelve
+  a validar desde su principio.
+*/
+static void follow_refresh(Follower *f) {
+    struct stat st;
+    if (fstat(f->fd, &st) != 0 ||
+        (f->reader.map && !f->reader.torn && (size_t)st.st_size == f->reader.map_size))
+        return;
+    journal_reader_close(&f->reader);
+    if (!journal_reader_open_fd(&f->reader, f->fd) || !f->reader.map)
+        return;
+    journal_seek(&f->reader, f->pos > f->reader.start ? f->pos : f->reader.start);
+}
+
+/* Imprime los tickets completos que siguen a la posición; uno a medio escribir se deja para luego. */
+static long follow_drain(Follower *f, const char *agent, size_t agent_len) {
+    long count = 0;
+    const TicketHeader *ticket;
+    while ((ticket = journal_next(&f->reader)) != NULL) {
+        if (agent && (strncmp(ticket->agent, agent, agent_len) != 0 ||
+                      (agent_len < JOURNAL_AGENT_SIZE && ticket->agent[agent_len] != '\0')))
+            continue;
+        print_ticket(stdout, ticket);
+        count++;
+    }
+    if (f->reader.map)
+        f->pos = f->reader.pos;
+    return count;
+}
+
+/* Descriptor del diario si ya no es el fichero que se sigue (se selló el segmento), o -1. */
+static int follow_next_segment(const Follower *f) {
+    struct stat now, current;
+    int fd = open(f->filename, O_RDONLY);
+    if (fd < 0)
+        return -1;            // Entre el rename() y el segmento nuevo
+    if (fstat(fd, &now) != 0 || fstat(f->fd, &current) != 0 ||
+        (now.st_ino == current.st_ino && now.st_dev == current.st_dev)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Avisos de cambios en el directorio del diario, o -1 si no hay inotify y se sondea. */
+static int follow_watch(const char *filename) {
+#ifdef __linux__
+    const char *slash = strrchr(filename, '/');
+    char *dir = slash ? strndup(filename, (size_t)(slash - filename) + 1) : strdup(".");
+    int fd = dir ? inotify_init1(IN_NONBLOCK | IN_CLOEXEC) : -1;
+    if (fd >= 0 && inotify_add_watch(fd, dir, IN_MODIFY | IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    free(dir);
+    return fd;
+#else
+    (void)filename;
+    return -1;
+#endif
+}
+
+/*
+  Espera a que cambie algo en el directorio del diario y descarta los avisos
+  acumulados: una ráfaga de ventas se lee de una vez. Sin inotify se sondea;
+  con él se mira de todos modos cada FOLLOW_RECHECK_MS por si un aviso no
+  llega (un diario en red, por ejemplo).
+*/
+static void follow_wait(int notify_fd) {
+    struct pollfd pfd = { .fd = notify_fd, .events = POLLIN, .revents = 0 };
+    poll(&pfd, 1, notify_fd >= 0 ? FOLLOW_RECHECK_MS : FOLLOW_POLL_MS);
+    if (notify_fd >= 0) {
+        char events[4096] __attribute__((aligned(8)));
+        while (read(notify_fd, events, sizeof(events)) > 0)
+            ;
+    }
+}
+
+/**
+ * Imprime los tickets según llegan al diario, opcionalmente de un agente,
+ * hasta que se interrumpe. Empieza al final del segmento activo y pasa al
+ * siguiente cuando se sella. En reposo duerme en inotify (o sondea).
+ *
+ * @return  1 si no se puede abrir el diario
+ */
+static int follow_tickets(const char *journalFile, const char *agent) {
+    Follower f = { .filename = journalFile, .fd = open(journalFile, O_RDONLY), .pos = 0 };
+    if (f.fd < 0) {
+        fprintf(stderr, "No se puede abrir '%s'.\n", journalFile);
+        return 1;
+    }
+    follow_refresh(&f);
+    if (f.reader.error[0]) {
+        fprintf(stderr, "No se puede leer '%s': %s\n", journalFile, f.reader.error);
+        close(f.fd);
+        return 1;
+    }
+    // Solo lo que llegue a partir de ahora. El tamaño puede caer en medio de
+    // un write(): se salta registro a registro y se empieza en el primero
+    // que no está completo.
+    while (journal_next(&f.reader) != NULL)
+        ;
+    f.pos = f.reader.pos;
+    size_t agent_len = agent ? strnlen(agent, JOURNAL_AGENT_SIZE) : 0;
+    int notify_fd = follow_watch(journalFile);
+    fprintf(stderr, "Siguiendo '%s'%s (Ctrl+C para salir)...\n", journalFile,
+            notify_fd >= 0 ? "" : " sondeando");
+    static char buffer[1 << 16];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+    for (;;) {
+        follow_refresh(&f);
+        follow_drain(&f, agent, agent_len);
+        int next;
+        while ((next = follow_next_segment(&f)) >= 0) {
+            // Todo el segmento viejo se escribió antes del rename(): una pasada más lo recoge.
+            follow_refresh(&f);
+            follow_drain(&f, agent, agent_len);
+            journal_reader_close(&f.reader);
+            close(f.fd);
+            f.fd = next;
+            f.pos = 0;
+            follow_refresh(&f);
+            follow_drain(&f, agent, agent_len);
+        }
+        fflush(stdout);
+        follow_wait(notify_fd);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Uso: %s export <diario> [salida]\n"
+                        "     %s reprint <diario> <ticket>\n"
+                        "     %s range <diario> <desde> [hasta] [agente]\n"
+                        "     %s top <diario> <producto|agente|hora> <desde> [hasta] [n]\n"
+                        "     %s follow <diario> [agente]\n",
+                argv[0], argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    const char *mode = argv[1];
+    if (strcmp(mode, "export") == 0) {
+        long count = export_tickets(argv[2], argc > 3 ? argv[3] : NULL);
+        if (count < 0)
+            return 1;
+        fprintf(stderr, "Exportados %ld tickets.\n", count);
+    } else if (strcmp(mode, "reprint") == 0 && argc > 3) {
+        return reprint_ticket(argv[2], argv[3]);
+    } else if (strcmp(mode, "range") == 0 && argc > 3) {
+        return print_range(argv[2], argv[3], argc > 4 ? argv[4] : argv[3], argc > 5 ? argv[5] : NULL);
+    } else if (strcmp(mode, "top") == 0 && argc > 4) {
+        return print_top(argv[2], argv[3], argv[4], argc > 5 ? argv[5] : argv[4], argc > 6 ? argv[6] : NULL);
+    } else if (strcmp(mode, "follow") == 0) {
+        return follow_tickets(argv[2], argc > 3 ? argv[3] : NULL);
+    } else {
+        fprintf(stderr, "Modo no reconocido o faltan argumentos. Use 'export', 'reprint', 'range', 'top' o 'follow'.\n");
+        return 1;
+    }
+    return 0;
+}
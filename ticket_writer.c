@@ -0,0 +1,173 @@
+/*
+  Hilo escritor del diario: cola circular sin cerrojos entre la caja y el
+  disco, con una sincronización por tanda de tickets.
+*/
+
+#include "ticket_writer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QUEUE_MASK (TICKET_QUEUE_SIZE - 1)
+
+_Static_assert((TICKET_QUEUE_SIZE & QUEUE_MASK) == 0, "TICKET_QUEUE_SIZE debe ser potencia de dos");
+
+/* Despierta a quien duerma en la cola (escritor, caja o un flush). */
+static void wake_all(TicketWriter *w) {
+    pthread_mutex_lock(&w->lock);
+    pthread_cond_broadcast(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+  Tras un fallo no se escribe nada más hasta reiniciar el programa: después
+  de un fdatasync() fallido no se sabe qué llegó al disco, y solo
+  journal_open() al arrancar vuelve a dejar el diario en un estado conocido.
+*/
+static void writer_fail(TicketWriter *w, const char *error) {
+    snprintf(w->error, sizeof(w->error), "%s", error);
+    atomic_store(&w->failed, true);
+}
+
+/**
+ * Escribe en el diario todo lo que haya en la cola y lo confirma con un
+ * único journal_sync(). Los huecos se liberan después, cuando ya se ha
+ * avisado de cada ticket en disco.
+ *
+ * @return  Posición de la cola hasta la que se ha tratado
+ */
+static size_t write_batch(TicketWriter *w, size_t head) {
+    size_t tail = atomic_load_explicit(&w->tail, memory_order_acquire);
+    uint64_t end = 0;
+    // La tanda anterior ya está en disco: es el momento de sellar el segmento.
+    const TicketHeader *first = (const TicketHeader *)w->slots[head & QUEUE_MASK].record;
+    if (!atomic_load(&w->failed) && journal_rotate_due(w->journal, first->timestamp) &&
+        !journal_rotate(w->journal) && w->journal->failed)
+        writer_fail(w, w->journal->error);
+    for (size_t i = head; i != tail; i++) {
+        QueuedTicket *slot = &w->slots[i & QUEUE_MASK];
+        slot->end = 0;
+        if (atomic_load(&w->failed))
+            continue;
+        if (journal_write_record(w->journal, slot->record, slot->size, &end))
+            slot->end = end;
+        else
+            writer_fail(w, w->journal->error);
+    }
+    bool durable = end > 0 && !atomic_load(&w->failed);
+    if (durable && !journal_sync(w->journal, end)) {
+        writer_fail(w, w->journal->error);
+        durable = false;
+    }
+    for (size_t i = head; i != tail; i++) {
+        QueuedTicket *slot = &w->slots[i & QUEUE_MASK];
+        if (durable && slot->end > 0 && w->on_durable)
+            w->on_durable((const TicketHeader *)slot->record, w->journal, slot->end, w->ctx);
+        free(slot->record);
+        slot->record = NULL;
+    }
+    atomic_store(&w->head, tail);
+    if (atomic_load(&w->submit_full))
+        wake_all(w);
+    return tail;
+}
+
+static void *writer_main(void *arg) {
+    TicketWriter *w = arg;
+    size_t head = atomic_load(&w->head);
+    for (;;) {
+        if (head == atomic_load(&w->tail)) {
+            if (atomic_load(&w->stop))
+                break;
+            pthread_mutex_lock(&w->lock);
+            atomic_store(&w->writer_idle, true);
+            if (head == atomic_load(&w->tail) && !atomic_load(&w->stop))
+                pthread_cond_wait(&w->wake, &w->lock);
+            atomic_store(&w->writer_idle, false);
+            pthread_mutex_unlock(&w->lock);
+            continue;
+        }
+        head = write_batch(w, head);
+        pthread_mutex_lock(&w->lock);
+        atomic_store(&w->done, head);
+        pthread_cond_broadcast(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+    }
+    return NULL;
+}
+
+/**
+ * Arranca el hilo escritor sobre un diario ya abierto.
+ *
+ * @param on_durable  Opcional; recibe cada ticket cuando ya está en disco
+ * @return            false si no se pudo crear el hilo
+ */
+bool ticket_writer_start(TicketWriter *w, Journal *journal, TicketDurableFn on_durable, void *ctx) {
+    memset(w, 0, sizeof(*w));
+    w->journal = journal;
+    w->on_durable = on_durable;
+    w->ctx = ctx;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->wake, NULL);
+    if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+        pthread_cond_destroy(&w->wake);
+        pthread_mutex_destroy(&w->lock);
+        snprintf(w->error, sizeof(w->error), "cannot start journal writer");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Codifica el ticket y lo encola para el escritor. Solo espera si la cola
+ * está llena, hasta que el escritor libere un hueco.
+ *
+ * @return  false si no hay memoria o el diario ya falló (w->failed, ver
+ *          w->error); un fallo del diario dura hasta reiniciar el programa
+ */
+bool ticket_writer_submit(TicketWriter *w, const TicketHeader *ticket, const TicketLine *lines,
+                          const char *const *names) {
+    if (atomic_load(&w->failed))
+        return false;
+    size_t size = journal_record_size(ticket, names);
+    char *record = size <= JOURNAL_MAX_RECORD ? malloc(size) : NULL;
+    if (!record)
+        return false;
+    journal_encode(ticket, lines, names, record);
+
+    size_t tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+    while (tail - atomic_load(&w->head) == TICKET_QUEUE_SIZE) {
+        pthread_mutex_lock(&w->lock);
+        atomic_store(&w->submit_full, true);
+        if (tail - atomic_load(&w->head) == TICKET_QUEUE_SIZE)
+            pthread_cond_wait(&w->wake, &w->lock);
+        atomic_store(&w->submit_full, false);
+        pthread_mutex_unlock(&w->lock);
+    }
+    QueuedTicket *slot = &w->slots[tail & QUEUE_MASK];
+    slot->record = record;
+    slot->size = size;
+    atomic_store(&w->tail, tail + 1);
+    if (atomic_load(&w->writer_idle))
+        wake_all(w);
+    return true;
+}
+
+/* Espera a que todo lo encolado hasta ahora esté en disco (o haya fallado). */
+void ticket_writer_flush(TicketWriter *w) {
+    size_t target = atomic_load(&w->tail);
+    pthread_mutex_lock(&w->lock);
+    while (atomic_load(&w->done) < target)
+        pthread_cond_wait(&w->wake, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Vacía la cola y para el hilo escritor. */
+void ticket_writer_stop(TicketWriter *w) {
+    atomic_store(&w->stop, true);
+    wake_all(w);
+    pthread_join(w->thread, NULL);
+    pthread_cond_destroy(&w->wake);
+    pthread_mutex_destroy(&w->lock);
+}
@@ -0,0 +1,69 @@
+/*
+  Escritor de tickets en segundo plano.
+
+  La caja no espera al disco: ticket_writer_submit() codifica el ticket, lo
+  deja en una cola circular acotada y vuelve. Un hilo escritor vacía la
+  cola, escribe todo lo que encuentra en el diario y lo confirma con un solo
+  journal_sync() por tanda; después avisa de cada ticket ya en disco.
+  Entre tandas, sin nada pendiente, sella el segmento del diario cuando
+  toca (journal_rotate()).
+
+  La cola tiene un único productor (la caja) y un único consumidor (el
+  escritor) y se recorre con índices atómicos, sin cerrojos. Solo cuando
+  está vacía (el escritor) o llena (la caja) el hilo se duerme en una
+  variable de condición hasta que el otro lado avance; con la cola llena la
+  caja espera, que es la contrapresión.
+
+  Si el diario falla, el escritor marca failed y descarta el resto de
+  tickets; no se recupera solo: hay que reiniciar el programa, que vuelve a
+  abrir y recortar el diario con journal_open().
+*/
+#ifndef TICKET_WRITER_H
+#define TICKET_WRITER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "journal.h"
+
+#define TICKET_QUEUE_SIZE 64      // Tickets en vuelo; potencia de dos
+
+typedef struct {
+    char     *record;             // Registro codificado (malloc)
+    size_t    size;
+    uint64_t  end;                // Final del registro en el diario; 0 si no se escribió
+} QueuedTicket;
+
+// Se llama desde el hilo escritor por cada ticket ya en disco, en orden;
+// 'end' es el final de su registro en el segmento activo de 'journal'.
+typedef void (*TicketDurableFn)(const TicketHeader *ticket, const Journal *journal, uint64_t end,
+                                void *ctx);
+
+typedef struct {
+    Journal          *journal;
+    TicketDurableFn   on_durable;
+    void             *ctx;
+    QueuedTicket      slots[TICKET_QUEUE_SIZE];
+    _Atomic size_t    head;        // Siguiente a escribir (escritor)
+    _Atomic size_t    tail;        // Siguiente hueco libre (caja)
+    _Atomic bool      writer_idle; // El escritor duerme con la cola vacía
+    _Atomic bool      submit_full; // La caja duerme con la cola llena
+    _Atomic bool      stop;
+    _Atomic bool      failed;      // El diario falló; ver error. Hasta reiniciar
+    _Atomic size_t    done;        // Tickets ya tratados (en disco o fallidos)
+    pthread_mutex_t   lock;        // Solo para dormir y despertar
+    pthread_cond_t    wake;
+    pthread_t         thread;
+    char              error[128];
+} TicketWriter;
+
+bool ticket_writer_start(TicketWriter *w, Journal *journal, TicketDurableFn on_durable, void *ctx);
+bool ticket_writer_submit(TicketWriter *w, const TicketHeader *ticket, const TicketLine *lines,
+                          const char *const *names);
+void ticket_writer_flush(TicketWriter *w);
+void ticket_writer_stop(TicketWriter *w);
+
+#endif